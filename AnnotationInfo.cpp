@@ -3,26 +3,31 @@
 
 using namespace llvm;
 
-AnnotationInfo::AnnotationInfo() : ModulePass(ID) {}
+AnnotationInfo::AnnotationInfo() : ImmutablePass(ID) {}
 
-bool AnnotationInfo::runOnModule(Module &M) {
+bool AnnotationInfo::hasAnnotation(Value *V, StringRef Ann, uint8_t level) {
+  StringRef A;
+  uint8_t L;
+  if (getAnnotation(V, A, L)) {
+    return A.equals(Ann) && L == level;
+  }
   return false;
 }
 
-bool AnnotationInfo::hasAnnotation(Value *V, StringRef Ann, uint8_t level) {
+bool AnnotationInfo::getAnnotation(Value *V, StringRef &Ann,
+                                   uint8_t &level) {
   // Check instruction metadata.
   if (auto *I = dyn_cast<Instruction>(V)) {
     MDNode *MD = I->getMetadata("tyann");
     if (MD) {
-      auto *MDS = cast<MDString>(MD->getOperand(0));
-      if (MDS->getString().equals(Ann)) {
-        auto *CAM = cast<ConstantAsMetadata>(MD->getOperand(1));
-        auto *CI = cast<ConstantInt>(CAM->getValue());
-        if (CI->getValue() == level) {
-          return true;
-        } else {
-          return false;
-        }
+      auto it = Cache.find(MD);
+      if (it == Cache.end()) {
+        it = Cache.insert(std::make_pair(MD, decode(MD))).first;
+      }
+      if (it->second.Ann) {
+        Ann = it->second.Ann->getString();
+        level = it->second.Level;
+        return true;
       }
     }
   }
@@ -32,6 +37,24 @@ bool AnnotationInfo::hasAnnotation(Value *V, StringRef Ann, uint8_t level) {
   return false;
 }
 
+// Decode a node. Malformed nodes decode to no annotation.
+AnnotationInfo::Decoded AnnotationInfo::decode(MDNode *MD) {
+  Decoded D = { nullptr, 0 };
+  if (MD->getNumOperands() != 2)
+    return D;
+
+  auto *LevelMD = dyn_cast<ConstantAsMetadata>(MD->getOperand(1));
+  if (!LevelMD)
+    return D;
+  auto *Level = dyn_cast<ConstantInt>(LevelMD->getValue());
+  if (!Level)
+    return D;
+
+  D.Ann = dyn_cast<MDString>(MD->getOperand(0));
+  D.Level = Level->getZExtValue();
+  return D;
+}
+
 char AnnotationInfo::ID = 0;
 static RegisterPass<AnnotationInfo> X("annotation-info",
                                       "gather type annotations",
@@ -1,12 +1,31 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/LegacyPassManager.h"
 
-struct AnnotationInfo : public llvm::ModulePass {
+// Type annotations arrive on instructions as `tyann` metadata. Clang emits
+// one node per (annotation, level) pair, and LLVM uniques identical nodes:
+//
+//   !tyann !{!"nullable", i8 0}
+//
+// AnnotationInfo decodes lazily (and caches by node), so it needs no
+// module-level setup and is an immutable pass.
+struct AnnotationInfo : public llvm::ImmutablePass {
   static char ID;
   AnnotationInfo();
-  virtual bool runOnModule(llvm::Module &M);
   bool hasAnnotation(llvm::Value *V, llvm::StringRef Ann, uint8_t level=0);
+
+  // Get the annotation on a value and its level. Returns false if the value
+  // is not annotated.
+  bool getAnnotation(llvm::Value *V, llvm::StringRef &Ann, uint8_t &level);
+
+private:
+  struct Decoded {
+    llvm::MDString *Ann;
+    uint8_t Level;
+  };
+  llvm::DenseMap<llvm::MDNode*, Decoded> Cache;
+  Decoded decode(llvm::MDNode *MD);
 };
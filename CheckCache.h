@@ -0,0 +1,216 @@
+#ifndef CHECK_CACHE_H
+#define CHECK_CACHE_H
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/SourceManager.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/MacroInfo.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <dlfcn.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace clang {
+
+// A checker diagnostic with its locations stored as offsets from the start
+// of the function it came from, so it stays valid when the function moves.
+struct CachedDiagnostic {
+  DiagnosticsEngine::Level Level;
+  unsigned Offset;
+  struct Range {
+    unsigned Begin, End;
+    bool IsTokenRange;
+  };
+  std::vector<Range> Ranges;
+  std::string Message;
+};
+
+// An on-disk cache of the diagnostics the checker produced for function
+// bodies, keyed by a hash of everything the result depends on (see
+// TAConsumer::cacheKey). Re-checking a file after an edit then only visits
+// the functions that changed. Each entry is a text file named after its
+// key:
+//
+//   quala-cache 1
+//   <level> <offset> <ranges or -> <message>
+//
+// with tab-separated fields and ranges written as begin:end:token,...
+// Entries are written to a temporary file and renamed into place, so any
+// number of compiles can share a directory.
+class CheckCache {
+public:
+  explicit CheckCache(llvm::StringRef _dir) : Dir(_dir), Hits(0), Misses(0) {}
+
+  std::string Dir;
+  unsigned Hits, Misses;
+
+  // The entry format, which is also part of every key.
+  static const char *version() { return "quala-cache 1"; }
+
+  // A hash of the shared object (or executable) containing Addr, to tell
+  // checker builds apart. Empty if it cannot be found.
+  static std::string hashBinaryOf(const void *Addr) {
+    Dl_info Info;
+    if (!dladdr(Addr, &Info) || !Info.dli_fname)
+      return std::string();
+    auto Buf = llvm::MemoryBuffer::getFile(Info.dli_fname);
+    if (!Buf)
+      return std::string();
+    llvm::MD5 H;
+    H.update((*Buf)->getBuffer());
+    llvm::MD5::MD5Result Res;
+    H.final(Res);
+    SmallString<32> Hex;
+    llvm::MD5::stringifyResult(Res, Hex);
+    return Hex.str();
+  }
+
+  bool lookup(llvm::StringRef Key, std::vector<CachedDiagnostic> &Diags) {
+    auto Buf = llvm::MemoryBuffer::getFile(path(Key));
+    if (!Buf || !parse(**Buf, Diags)) {
+      Diags.clear();
+      ++Misses;
+      return false;
+    }
+    ++Hits;
+    return true;
+  }
+
+  std::error_code store(llvm::StringRef Key,
+                        const std::vector<CachedDiagnostic> &Diags) {
+    std::error_code EC = llvm::sys::fs::create_directories(Dir);
+    if (EC)
+      return EC;
+
+    int FD;
+    SmallString<128> Tmp;
+    EC = llvm::sys::fs::createUniqueFile(path(Key) + "-%%%%%%.tmp", FD, Tmp);
+    if (EC)
+      return EC;
+    {
+      llvm::raw_fd_ostream OS(FD, true);
+      OS << version() << "\n";
+      for (auto &D : Diags) {
+        OS << (unsigned)D.Level << "\t" << D.Offset << "\t";
+        if (D.Ranges.empty())
+          OS << "-";
+        for (size_t i = 0; i < D.Ranges.size(); ++i) {
+          OS << (i ? "," : "") << D.Ranges[i].Begin << ":" << D.Ranges[i].End
+             << ":" << D.Ranges[i].IsTokenRange;
+        }
+        OS << "\t" << D.Message << "\n";
+      }
+    }
+    EC = llvm::sys::fs::rename(Tmp, path(Key));
+    if (EC)
+      llvm::sys::fs::remove(Tmp);
+    return EC;
+  }
+
+private:
+  std::string path(llvm::StringRef Key) const {
+    SmallString<128> P(Dir);
+    llvm::sys::path::append(P, Key + ".qcache");
+    return P.str();
+  }
+
+  static bool parse(const llvm::MemoryBuffer &Buf,
+                    std::vector<CachedDiagnostic> &Diags) {
+    llvm::line_iterator Line(Buf);
+    if (Line.is_at_eof() || *Line != version())
+      return false;
+
+    SmallVector<llvm::StringRef, 4> Fields;
+    SmallVector<llvm::StringRef, 4> Ranges;
+    for (++Line; !Line.is_at_eof(); ++Line) {
+      Fields.clear();
+      Line->split(Fields, "\t", 3);
+      unsigned Level;
+      CachedDiagnostic D;
+      if (Fields.size() != 4 || Fields[0].getAsInteger(10, Level) ||
+          Level > DiagnosticsEngine::Fatal ||
+          Fields[1].getAsInteger(10, D.Offset))
+        return false;
+      D.Level = (DiagnosticsEngine::Level)Level;
+      D.Message = Fields[3].str();
+
+      if (Fields[2] != "-") {
+        Ranges.clear();
+        Fields[2].split(Ranges, ",");
+        for (auto R : Ranges) {
+          SmallVector<llvm::StringRef, 3> Parts;
+          R.split(Parts, ":");
+          CachedDiagnostic::Range CR;
+          unsigned Tok;
+          if (Parts.size() != 3 || Parts[0].getAsInteger(10, CR.Begin) ||
+              Parts[1].getAsInteger(10, CR.End) ||
+              Parts[2].getAsInteger(10, Tok))
+            return false;
+          CR.IsTokenRange = Tok;
+          D.Ranges.push_back(CR);
+        }
+      }
+      Diags.push_back(D);
+    }
+    return true;
+  }
+};
+
+// Remembers which macro definitions were expanded where. A function's text
+// does not show what its macros (like the one wrapping an annotation)
+// expand to, so cache keys include the definitions of the macros expanded
+// inside the function.
+class MacroExpansions : public PPCallbacks {
+public:
+  MacroExpansions(SourceManager &_sm, const LangOptions &_lo) :
+    SM(_sm), LO(_lo) {}
+
+  virtual void MacroExpands(const Token &MacroNameTok,
+                            const MacroDefinition &MD, SourceRange Range,
+                            const MacroArgs *Args) {
+    if (const MacroInfo *MI = MD.getMacroInfo()) {
+      SourceLocation Loc = SM.getExpansionLoc(Range.getBegin());
+      Expansions.insert(std::make_pair(Loc.getRawEncoding(), MI));
+    }
+  }
+
+  // Add the definitions of the macros expanded in [Begin, End] (file
+  // locations in the same file) to a hash.
+  void hash(SourceLocation Begin, SourceLocation End, llvm::MD5 &H) const {
+    auto I = Expansions.lower_bound(Begin.getRawEncoding());
+    auto Last = Expansions.upper_bound(End.getRawEncoding());
+    for (; I != Last; ++I) {
+      const MacroInfo *MI = I->second;
+      H.update("\nmacro ");
+      if (MI->isBuiltinMacro())
+        continue;  // Like __LINE__, which only the text can change.
+      SourceLocation DefBegin = MI->getDefinitionLoc();
+      SourceLocation DefEnd = MI->getDefinitionEndLoc();
+      if (DefBegin.isInvalid() || DefEnd.isInvalid())
+        continue;
+      const char *B = SM.getCharacterData(DefBegin);
+      const char *E = SM.getCharacterData(DefEnd) +
+                      Lexer::MeasureTokenLength(DefEnd, SM, LO);
+      H.update(llvm::StringRef(B, E - B));
+    }
+  }
+
+private:
+  SourceManager &SM;
+  const LangOptions &LO;
+  std::multimap<unsigned, const MacroInfo*> Expansions;
+};
+
+}
+
+#endif
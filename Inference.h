@@ -0,0 +1,185 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#include "clang/AST/AST.h"
+#include "clang/AST/Mangle.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <stdlib.h>
+
+namespace clang {
+
+// Writes a translation unit's qualifier-flow constraints for whole-program
+// inference. Each TU writes its summary independently (so the phase is as
+// parallel as the build); tools/quala-infer then merges all the summaries
+// and solves them.
+//
+// A summary is a text file with one tab-separated record per line:
+//
+//   quala-summary 1
+//   n <id> <key> <declared annotation or -> <location> <name>
+//   f <source id> <destination id>
+//
+// Node records come before the flows that use them. IDs are local to the
+// file; keys identify the same node across files. Declarations with
+// external linkage are keyed by their (mangled) name, everything else also
+// by the real path of the main file (or, for locals, of the file that
+// declares them), and annotation constants like a null literal by the
+// annotation alone.
+class ConstraintSummary {
+public:
+  ConstraintSummary(ASTContext &_ctx, llvm::raw_ostream &_os) :
+    Ctx(_ctx),
+    OS(_os),
+    Mangler(_ctx.createMangleContext())
+  {
+    const SourceManager &SM = Ctx.getSourceManager();
+    if (const FileEntry *FE = SM.getFileEntryForID(SM.getMainFileID()))
+      MainFile = pathOf(FE);
+    OS << "quala-summary 1\n";
+  }
+
+  // The real path of a file. File names are relative to the compiler's
+  // working directory, so under a recursive make, a/foo.c and b/foo.c are
+  // both just "foo.c".
+  static std::string realPath(const FileManager &FM, const FileEntry *FE) {
+    SmallString<128> Abs(FE->getName());
+    FM.makeAbsolutePath(Abs);
+    if (char *Real = ::realpath(Abs.c_str(), nullptr)) {
+      std::string Path(Real);
+      ::free(Real);
+      return Path;
+    }
+    return Abs.str();
+  }
+
+  // The node for a variable, parameter, or field.
+  unsigned node(const ValueDecl *D, StringRef DeclaredAnn) {
+    unsigned &ID = DeclNodes[D];
+    if (!ID) {
+      ID = newNode(keyFor(D), DeclaredAnn, D->getLocation(), nameOf(D));
+    }
+    return ID;
+  }
+
+  // The node for a function's return value.
+  unsigned returnNode(const FunctionDecl *D, StringRef DeclaredAnn) {
+    unsigned &ID = ReturnNodes[D];
+    if (!ID) {
+      ID = newNode("ret:" + keyFor(D), DeclaredAnn, D->getLocation(),
+                   nameOf(D) + " (return)");
+    }
+    return ID;
+  }
+
+  // The node for a value that carries an annotation on its own, like a null
+  // literal.
+  unsigned constant(StringRef Ann) {
+    unsigned &ID = ConstantNodes[Ann];
+    if (!ID) {
+      ID = newNode("const:" + Ann.str(), Ann, SourceLocation(), Ann);
+    }
+    return ID;
+  }
+
+  void flow(unsigned Src, unsigned Dst) {
+    if (Src != Dst && Flows.insert(std::make_pair(Src, Dst)).second)
+      OS << "f\t" << Src << "\t" << Dst << "\n";
+  }
+
+private:
+  ASTContext &Ctx;
+  llvm::raw_ostream &OS;
+  std::unique_ptr<MangleContext> Mangler;
+  std::string MainFile;
+  llvm::DenseMap<const FileEntry*, std::string> FilePaths;
+  unsigned NextID = 1;
+  llvm::DenseMap<const ValueDecl*, unsigned> DeclNodes;
+  llvm::DenseMap<const FunctionDecl*, unsigned> ReturnNodes;
+  llvm::StringMap<unsigned> ConstantNodes;
+  llvm::DenseSet< std::pair<unsigned, unsigned> > Flows;
+
+  std::string pathOf(const FileEntry *FE) {
+    std::string &Path = FilePaths[FE];
+    if (Path.empty())
+      Path = realPath(Ctx.getSourceManager().getFileManager(), FE);
+    return Path;
+  }
+
+  unsigned newNode(const std::string &Key, StringRef DeclaredAnn,
+                   SourceLocation Loc, StringRef Name) {
+    unsigned ID = NextID++;
+    OS << "n\t" << ID << "\t" << Key << "\t"
+       << (DeclaredAnn.size() ? DeclaredAnn : "-") << "\t";
+    const SourceManager &SM = Ctx.getSourceManager();
+    PresumedLoc PLoc = SM.getPresumedLoc(SM.getExpansionLoc(Loc));
+    if (PLoc.isValid())
+      OS << PLoc.getFilename() << ":" << PLoc.getLine() << ":"
+         << PLoc.getColumn();
+    else
+      OS << "-";
+    OS << "\t" << Name << "\n";
+    return ID;
+  }
+
+  // The name to show in suggestions. Locals and parameters are qualified by
+  // their location instead.
+  static std::string nameOf(const ValueDecl *D) {
+    if (D->getParentFunctionOrMethod())
+      return D->getNameAsString();
+    return D->getQualifiedNameAsString();
+  }
+
+  // A name for the declaration that is the same in every TU that can see
+  // it.
+  std::string keyFor(const ValueDecl *D) {
+    std::string Key;
+    llvm::raw_string_ostream KOS(Key);
+
+    if (auto *P = dyn_cast<ParmVarDecl>(D)) {
+      // Parameters belong to their function.
+      auto *F = dyn_cast<FunctionDecl>(P->getDeclContext());
+      if (F) {
+        KOS << "param:" << keyFor(F) << ":" << P->getFunctionScopeIndex();
+        return KOS.str();
+      }
+    }
+
+    auto *VD = dyn_cast<VarDecl>(D);
+    if (VD && VD->isLocalVarDecl()) {
+      // Locals are identified by where they are declared: the offset is
+      // only meaningful in the file that holds it, which may be a header
+      // (for a local in an inline function, say).
+      const SourceManager &SM = Ctx.getSourceManager();
+      SourceLocation Loc = SM.getExpansionLoc(D->getLocation());
+      const FileEntry *FE = SM.getFileEntryForID(SM.getFileID(Loc));
+      KOS << "local:" << (FE ? pathOf(FE) : MainFile) << ":"
+          << SM.getFileOffset(Loc);
+      return KOS.str();
+    }
+
+    if (isa<FieldDecl>(D)) {
+      // All instances of a field share one node.
+      KOS << "field:";
+    } else if (!D->isExternallyVisible()) {
+      KOS << "static:" << MainFile << ":";
+    }
+
+    if (Mangler->shouldMangleDeclName(D) && !isa<CXXConstructorDecl>(D) &&
+        !isa<CXXDestructorDecl>(D))
+      Mangler->mangleName(D, KOS);
+    else
+      KOS << D->getQualifiedNameAsString();
+    return KOS.str();
+  }
+};
+
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef TIME_TRACE_H
+#define TIME_TRACE_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace clang {
+
+// A recorder for checker profiles in the Chrome trace event format (the same
+// format as Clang's -ftime-trace), viewable in chrome://tracing or Speedscope.
+// Durations are complete ("X") events; counts are emitted as one counter
+// ("C") event per group at the end of the trace.
+class TimeTrace {
+public:
+  TimeTrace() : Start(std::chrono::steady_clock::now()) {}
+
+  // Times its own lifetime as an event. A null trace makes this a no-op, so
+  // callers need not check whether tracing is on.
+  class Scope {
+  public:
+    Scope(TimeTrace *_trace, llvm::StringRef Name, llvm::StringRef Detail) :
+      Trace(_trace)
+    {
+      if (Trace) {
+        Index = Trace->Events.size();
+        Trace->Events.push_back(
+          Event{Name.str(), Detail.str(), Trace->now(), 0}
+        );
+      }
+    }
+    ~Scope() {
+      if (Trace) {
+        Event &E = Trace->Events[Index];
+        E.Duration = Trace->now() - E.Timestamp;
+      }
+    }
+
+  private:
+    TimeTrace *Trace;
+    size_t Index;
+  };
+
+  // Increment a named counter in a group.
+  void count(llvm::StringRef Group, llvm::StringRef Name, uint64_t N=1) {
+    Counters[Group][Name] += N;
+  }
+
+  void write(llvm::raw_ostream &OS) const {
+    OS << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (auto &E : Events) {
+      comma(OS, first);
+      OS << "{\"name\":";
+      quote(OS, E.Name);
+      OS << ",\"ph\":\"X\",\"pid\":1,\"tid\":0"
+         << ",\"ts\":" << E.Timestamp
+         << ",\"dur\":" << E.Duration
+         << ",\"args\":{\"detail\":";
+      quote(OS, E.Detail);
+      OS << "}}";
+    }
+
+    uint64_t End = now();
+    for (auto &G : Counters) {
+      comma(OS, first);
+      OS << "{\"name\":";
+      quote(OS, G.getKey());
+      OS << ",\"ph\":\"C\",\"pid\":1,\"tid\":0,\"ts\":" << End
+         << ",\"args\":{";
+      bool firstArg = true;
+      for (auto &C : G.getValue()) {
+        comma(OS, firstArg);
+        quote(OS, C.getKey());
+        OS << ":" << C.getValue();
+      }
+      OS << "}}";
+    }
+    OS << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  }
+
+private:
+  struct Event {
+    std::string Name;
+    std::string Detail;
+    uint64_t Timestamp;  // Microseconds since the trace started.
+    uint64_t Duration;
+  };
+
+  std::chrono::steady_clock::time_point Start;
+  std::vector<Event> Events;
+  llvm::StringMap< llvm::StringMap<uint64_t> > Counters;
+
+  uint64_t now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - Start
+    ).count();
+  }
+
+  static void comma(llvm::raw_ostream &OS, bool &first) {
+    if (!first)
+      OS << ",\n";
+    first = false;
+  }
+
+  static void quote(llvm::raw_ostream &OS, llvm::StringRef S) {
+    OS << '"';
+    for (char c : S) {
+      if (c == '"' || c == '\\') {
+        OS << '\\' << c;
+      } else if ((unsigned char)c < 0x20) {
+        OS << "\\u00";
+        OS.write_hex((unsigned char)c >> 4);
+        OS.write_hex(c & 0xf);
+      } else {
+        OS << c;
+      }
+    }
+    OS << '"';
+  }
+};
+
+}
+
+#endif
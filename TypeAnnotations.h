@@ -2,16 +2,35 @@
 #define TYPE_ANNOTATIONS_H
 
 #include "clang/AST/RecursiveASTVisitor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/Support/raw_ostream.h"
 #include "clang/AST/AST.h"
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/ASTDiagnostic.h"
+#include "clang/AST/Attr.h"
 #include "clang/AST/StmtVisitor.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Path.h"
 #include "clang/Frontend/MultiplexConsumer.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "CheckCache.h"
+#include "Inference.h"
+#include "TimeTrace.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #define DEBUG_TYPE "quala"
 
@@ -25,6 +44,86 @@ public:
   std::vector<ASTConsumer*> Consumers;
 };
 
+// Options common to all checkers. Plugin actions parse these from their
+// arguments, e.g., -Xclang -plugin-arg-nullness -Xclang time-trace=t.json.
+struct TAOptions {
+  // Write a Chrome trace (like -ftime-trace) of the checker to this file.
+  std::string TimeTraceFile;
+
+  // Report how much the checker grows the AST's memory.
+  bool MemReport;
+
+  // Write an inference constraint summary for this TU into this directory.
+  std::string InferDir;
+
+  // Check top-level declarations on this many threads (0 for one per
+  // core). Only used with -fsyntax-only, since code generation needs the
+  // annotations in the AST.
+  unsigned Jobs;
+
+  // Cache each function's results in this directory and reuse them while
+  // the function and what it depends on are unchanged. Also only used with
+  // -fsyntax-only.
+  std::string CacheDir;
+
+  // Stop checking a function body after visiting this many statements, or
+  // after this many milliseconds (budget=N or budget=Nms; 0 for no limit).
+  // The rest of the body goes unchecked, with a warning. With
+  // over-budget=conservative, the function is also marked "quala-unchecked"
+  // for code generation, so passes can compensate at run time.
+  unsigned BudgetStmts;
+  unsigned BudgetMillis;
+  bool BudgetConservative;
+
+  // The arguments that can change what the checker reports, for cache keys.
+  std::vector<std::string> ResultArgs;
+
+  TAOptions() : MemReport(false), Jobs(1), BudgetStmts(0), BudgetMillis(0),
+                BudgetConservative(false) {}
+
+  bool Parse(const CompilerInstance &CI,
+             const std::vector<std::string> &args) {
+    for (auto &arg : args) {
+      StringRef Arg(arg);
+      if (!Arg.startswith("time-trace=") && Arg != "mem-report" &&
+          !Arg.startswith("jobs=") && !Arg.startswith("cache="))
+        ResultArgs.push_back(arg);
+      if (Arg.startswith("time-trace=")) {
+        TimeTraceFile = Arg.substr(strlen("time-trace="));
+      } else if (Arg == "mem-report") {
+        MemReport = true;
+      } else if (Arg.startswith("infer=")) {
+        InferDir = Arg.substr(strlen("infer="));
+      } else if (Arg.startswith("jobs=") &&
+                 !Arg.substr(strlen("jobs=")).getAsInteger(10, Jobs)) {
+        // Parsed.
+      } else if (Arg.startswith("cache=")) {
+        CacheDir = Arg.substr(strlen("cache=")).str();
+      } else if (Arg.startswith("budget=") && Arg.endswith("ms") &&
+                 !Arg.drop_front(strlen("budget=")).drop_back(2)
+                     .getAsInteger(10, BudgetMillis)) {
+        // Parsed.
+      } else if (Arg.startswith("budget=") &&
+                 !Arg.substr(strlen("budget=")).getAsInteger(10, BudgetStmts)) {
+        // Parsed.
+      } else if (Arg == "over-budget=skip") {
+        BudgetConservative = false;
+      } else if (Arg == "over-budget=conservative") {
+        BudgetConservative = true;
+      } else {
+        DiagnosticsEngine &D = CI.getDiagnostics();
+        unsigned did = D.getCustomDiagID(
+          DiagnosticsEngine::Error,
+          "unknown type checker argument '%0'"
+        );
+        D.Report(did) << Arg;
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
 template<typename ImplClass>
 class Annotator : public StmtVisitor<ImplClass> {
 public:
@@ -32,22 +131,101 @@ public:
   ImplClass *impl;
   FunctionDecl *CurFunc;
   bool Instrument;
+  TimeTrace *Trace;  // Profile counters; null unless tracing.
+  ConstraintSummary *Summary;  // Inference output; null unless inferring.
+
+  // When checking in parallel, each worker has its own annotator. It keeps
+  // expression types in a side table instead of the shared AST, reports to
+  // its own diagnostics engine, and creates types under a shared lock.
+  // All three are null when checking serially.
+  llvm::DenseMap<const Expr*, QualType> *Types;
+  DiagnosticsEngine *DiagEngine;
+  std::mutex *ContextLock;
 
   Annotator(CompilerInstance &_ci, bool _instrument) :
     CI(_ci),
     impl(static_cast<ImplClass*>(this)),
     CurFunc(NULL),
-    Instrument(_instrument)
+    Instrument(_instrument),
+    Trace(NULL),
+    Summary(NULL),
+    Types(NULL),
+    DiagEngine(NULL),
+    ContextLock(NULL),
+    AddStats()
   {};
 
+  /*** EXPRESSION TYPES ***/
+
+  // The type the checker has given an expression. Use this rather than
+  // E->getType() to see annotations added by the typing rules.
+  QualType TypeOf(const Expr *E) const {
+    if (Types) {
+      auto it = Types->find(E);
+      if (it != Types->end())
+        return it->second;
+    }
+    return E->getType();
+  }
+
+  void SetTypeOf(Expr *E, QualType T) const {
+    if (Types)
+      (*Types)[E] = T;
+    else
+      E->setType(T);
+  }
+
+  // The ASTContext is not thread-safe. Create types through this, e.g.,
+  // MakeType([&](ASTContext &Ctx) { return Ctx.getPointerType(T); }).
+  template <typename F>
+  QualType MakeType(F Make) const {
+    std::unique_lock<std::mutex> Guard;
+    if (ContextLock)
+      Guard = std::unique_lock<std::mutex>(*ContextLock);
+    return Make(CI.getASTContext());
+  }
+
   /*** ANNOTATION ASSIGNMENT HELPERS ***/
 
+  // What AddAnnotation did, for profiling and memory reports.
+  struct AddAnnotationStats {
+    unsigned Skipped;  // Already had the annotation.
+    unsigned Reused;   // Found in the annotated type cache.
+    unsigned Created;  // Requested from the ASTContext.
+  };
+  mutable AddAnnotationStats AddStats;
+
   void AddAnnotation(Expr *E, StringRef A) const {
-    // TODO check whether it already has the annotation & do nothing
-    if (A.size()) {
-      E->setType(CI.getASTContext().getAnnotatedType(E->getType(), A));
+    if (!A.size())
+      return;
+
+    // Most propagation rules (implicit casts in particular) see types that
+    // already carry the annotation at the top. Only the outermost layer
+    // counts: an annotation under a typedef is still added on top, since
+    // that is where code generation looks for it.
+    QualType T = TypeOf(E);
+    if (auto *AT = dyn_cast<AnnotatedType>(T)) {
+      if (AT->getAnnotation() == A) {
+        ++AddStats.Skipped;
+        return;
+      }
     }
+
+    // Reuse the annotated version of the type if we have made it before.
+    // This skips the ASTContext's uniquing, which has to profile the type
+    // and the annotation string for every request.
+    QualType &Annotated = AnnotatedTypes[A][T.getAsOpaquePtr()];
+    if (Annotated.isNull()) {
+      Annotated = MakeType([&](ASTContext &Ctx) {
+        return Ctx.getAnnotatedType(T, A);
+      });
+      ++AddStats.Created;
+    } else {
+      ++AddStats.Reused;
+    }
+    SetTypeOf(E, Annotated);
   }
+  mutable llvm::StringMap< llvm::DenseMap<void*, QualType> > AnnotatedTypes;
 
   // Remove an annotated type *at the outermost level of the type tree*. For
   // example, this will not remove annotations under typedefs (which seems
@@ -55,9 +233,9 @@ public:
   void RemoveAnnotation(Expr *E) const {
     // TODO remove a specific annotation? or all, if multiple?
     // Look for an AnnotatedType in the desugaring chain.
-    QualType T = E->getType();
+    QualType T = TypeOf(E);
     if (auto *AT = dyn_cast<AnnotatedType>(T)) {
-      E->setType(AT->getBaseType());
+      SetTypeOf(E, AT->getBaseType());
     }
   }
 
@@ -79,29 +257,33 @@ public:
   }
 
   llvm::StringRef AnnotationOf(QualType QT) const {
+    if (Trace)
+      Trace->count("AnnotationOf", "calls");
+
     // Try implicit annotation.
     StringRef ImplicitAnn = impl->ImplicitAnnotation(QT);
     if (ImplicitAnn.size()) {
       return ImplicitAnn;
     }
 
-    // Look up the annotation.
-    auto &Ctx = CI.getASTContext();
-    for (;;) {
-      const Type *T = QT.getTypePtrOrNull();
-      if (!T) {
-        return StringRef();
-      }
+    // Look up the annotation. Qualifiers never hide an annotation, so walk
+    // the unqualified sugar chain: unlike desugaring the qualified type,
+    // this creates no types (and so is safe in parallel).
+    const Type *T = QT.getTypePtrOrNull();
+    while (T) {
       StringRef Ann = AnnotationOf(T);
       if (Ann.size())
         return Ann;
 
       // Try stripping away one level of sugar.
-      QualType DT = QT.getSingleStepDesugaredType(Ctx);
-      if (DT == QT) {
+      const Type *DT =
+        T->getLocallyUnqualifiedSingleStepDesugaredType().getTypePtrOrNull();
+      if (DT == T) {
         break;
       } else {
-        QT = DT;
+        if (Trace)
+          Trace->count("AnnotationOf", "desugaring steps");
+        T = DT;
       }
     }
 
@@ -113,7 +295,7 @@ public:
     if (!E) {
       return StringRef();
     } else {
-      return AnnotationOf(E->getType());
+      return AnnotationOf(TypeOf(E));
     }
   }
 
@@ -125,6 +307,34 @@ public:
     }
   }
 
+  // Is an annotation written anywhere in a type: on the type itself, on
+  // what it points to, on its elements, or on a function's return or
+  // parameter types? Type systems that give out an annotation of their own
+  // (one users are not supposed to write) use this to reject it.
+  bool SpellsAnnotation(QualType T, StringRef Ann) const {
+    while (!T.isNull()) {
+      if (AnnotationOf(T) == Ann)
+        return true;
+      if (auto *FPT = T->getAs<FunctionProtoType>()) {
+        for (QualType P : FPT->getParamTypes()) {
+          if (SpellsAnnotation(P, Ann))
+            return true;
+        }
+      }
+      if (auto *FT = T->getAs<FunctionType>()) {
+        T = FT->getReturnType();
+      } else if (T->isPointerType() || T->isReferenceType() ||
+                 T->isMemberPointerType()) {
+        T = T->getPointeeType();
+      } else if (auto *AT = T->getAsArrayTypeUnsafe()) {
+        T = AT->getElementType();
+      } else {
+        break;
+      }
+    }
+    return false;
+  }
+
   bool SamePointerTypeAnnotations(QualType T1, QualType T2,
                                   bool outer=true) const {
     // Optionally check the annotation on the types themselves.
@@ -179,7 +389,7 @@ public:
   }
 
   DiagnosticsEngine &Diags() const {
-    return CI.getDiagnostics();
+    return DiagEngine ? *DiagEngine : CI.getDiagnostics();
   }
 
   void EmitIncompatibleError(clang::Stmt* S, QualType LTy,
@@ -196,17 +406,121 @@ public:
         << CharSourceRange(S->getSourceRange(), false);
   }
 
+  /*** INFERENCE CONSTRAINTS ***/
+
+  // Override this to restrict inference to the types your annotation makes
+  // sense on (e.g., pointers).
+  bool Inferable(QualType QT) const {
+    return true;
+  }
+
+  // Record that the value of E flows into the variable or field D.
+  void RecordFlow(ValueDecl *D, Expr *E) {
+    if (!Summary || !D || !impl->Inferable(D->getType()))
+      return;
+    RecordFlow(Summary->node(D, AnnotationOf(D)), E);
+  }
+
+  // Record that the value of E flows into the destination of an assignment.
+  void RecordFlow(Expr *LHS, Expr *E) {
+    if (!Summary)
+      return;
+    LHS = LHS->IgnoreParenImpCasts();
+    if (auto *DRE = dyn_cast<DeclRefExpr>(LHS)) {
+      RecordFlow(dyn_cast<VarDecl>(DRE->getDecl()), E);
+    } else if (auto *ME = dyn_cast<MemberExpr>(LHS)) {
+      RecordFlow(dyn_cast<FieldDecl>(ME->getMemberDecl()), E);
+    }
+    // Stores through pointers and into arrays are not tracked: the summary
+    // only has nodes for top-level annotations.
+  }
+
+  // Record that the value of E is returned from F.
+  void RecordReturnFlow(FunctionDecl *F, Expr *E) {
+    if (!Summary || !impl->Inferable(F->getReturnType()))
+      return;
+    RecordFlow(Summary->returnNode(F, AnnotationOf(F->getReturnType())), E);
+  }
+
+  void RecordFlow(unsigned Dst, Expr *E) {
+    SmallVector<unsigned, 4> Srcs;
+    SourcesOf(E, Srcs);
+    for (unsigned Src : Srcs)
+      Summary->flow(Src, Dst);
+  }
+
+  // Find the summary nodes whose values make up the value of E: variables,
+  // fields, and function results, plus a constant node for any other
+  // subexpression that has an annotation of its own (a null literal, an
+  // endorsement).
+  void SourcesOf(Expr *E, SmallVectorImpl<unsigned> &Srcs) {
+    E = E->IgnoreParens();
+
+    if (auto *DRE = dyn_cast<DeclRefExpr>(E)) {
+      if (auto *VD = dyn_cast<VarDecl>(DRE->getDecl())) {
+        Srcs.push_back(Summary->node(VD, AnnotationOf(VD)));
+        return;
+      }
+    } else if (auto *ME = dyn_cast<MemberExpr>(E)) {
+      if (auto *FD = dyn_cast<FieldDecl>(ME->getMemberDecl())) {
+        Srcs.push_back(Summary->node(FD, AnnotationOf(FD)));
+        return;
+      }
+    } else if (auto *CE = dyn_cast<CallExpr>(E)) {
+      FunctionDecl *F = CE->getDirectCallee();
+      if (F && !F->getBuiltinID()) {
+        Srcs.push_back(
+          Summary->returnNode(F, AnnotationOf(F->getReturnType()))
+        );
+        return;
+      }
+    }
+
+    // Implicit casts only pass their operand's annotation along.
+    StringRef Ann = AnnotationOf(E);
+    if (Ann.size() && !isa<ImplicitCastExpr>(E))
+      Srcs.push_back(Summary->constant(Ann));
+
+    // Look through operators that pass their operands' values along. Not
+    // through dereferences, subscripts, or address-of: those values belong
+    // to a different pointer level.
+    bool Propagates = isa<CastExpr>(E) || isa<BinaryOperator>(E) ||
+                      isa<AbstractConditionalOperator>(E);
+    if (auto *UO = dyn_cast<UnaryOperator>(E))
+      Propagates = UO->getOpcode() != UO_Deref &&
+                   UO->getOpcode() != UO_AddrOf;
+    if (auto *ACO = dyn_cast<AbstractConditionalOperator>(E)) {
+      // The condition only decides which value flows.
+      SourcesOf(ACO->getTrueExpr(), Srcs);
+      SourcesOf(ACO->getFalseExpr(), Srcs);
+    } else if (Propagates) {
+      for (auto I = E->child_begin(), End = E->child_end(); I != End; ++I) {
+        if (auto *Child = dyn_cast_or_null<Expr>(*I))
+          SourcesOf(Child, Srcs);
+      }
+    }
+  }
+
+  /*** DECLARATION CHECKS ***/
+
+  // Override this to check declarations themselves (variables, fields,
+  // parameters, and functions), e.g., to restrict where an annotation may
+  // appear.
+  void CheckDecl(ValueDecl *D) {}
+
   /*** DEFAULT TYPING RULES ***/
 
   // Assignment compatibility.
   void VisitBinAssign(BinaryOperator *E) {
-    AssertCompatible(E, E->getLHS()->getType(), E->getRHS()->getType());
+    AssertCompatible(E, TypeOf(E->getLHS()), TypeOf(E->getRHS()));
     AddAnnotation(E, AnnotationOf(E->getLHS()));
+    RecordFlow(E->getLHS(), E->getRHS());
   }
 
   void VisitCompoundAssignOperator(CompoundAssignOperator *E) {
-    AssertCompatible(E, E->getLHS()->getType(), E->getRHS()->getType());
+    AssertCompatible(E, TypeOf(E->getLHS()), TypeOf(E->getRHS()));
     AddAnnotation(E, AnnotationOf(E->getLHS()));
+    RecordFlow(E->getLHS(), E->getRHS());
   }
 
   // Declaration initializers treated like assignments.
@@ -216,7 +530,8 @@ public:
       if (VD) {
         Expr *Init = VD->getInit();
         if (Init) {
-          AssertCompatible(Init, VD->getType(), Init->getType());
+          AssertCompatible(Init, VD->getType(), TypeOf(Init));
+          RecordFlow(VD, Init);
         }
       }
     }
@@ -240,7 +555,8 @@ public:
         auto pi = D->param_begin();
         auto ai = E->arg_begin();
         for (; pi != D->param_end() && ai != E->arg_end(); ++pi, ++ai) {
-          AssertCompatible(*ai, (*pi)->getType(), (*ai)->getType());
+          AssertCompatible(*ai, (*pi)->getType(), TypeOf(*ai));
+          RecordFlow(*pi, *ai);
         }
       } else {
         // Parameter list length mismatch. Probably a varargs function. FIXME?
@@ -268,11 +584,95 @@ public:
     Expr *E = S->getRetValue();
     if (E) {
       assert(CurFunc && "return outside of function?");
-      AssertCompatible(S, CurFunc->getReturnType(), E->getType());
+      AssertCompatible(S, CurFunc->getReturnType(), TypeOf(E));
+      RecordReturnFlow(CurFunc, E);
     }
   }
 };
 
+// Keeps a worker's diagnostics so the main thread can report them later, in
+// order.
+class BufferedDiagnostics : public DiagnosticConsumer {
+public:
+  struct Entry {
+    DiagnosticsEngine::Level Level;
+    SourceLocation Loc;
+    std::string Message;
+    SmallVector<CharSourceRange, 2> Ranges;
+  };
+  std::vector<Entry> Entries;
+
+  // Held while formatting: type arguments may desugar through the
+  // ASTContext.
+  std::mutex *FormatLock;
+
+  BufferedDiagnostics() : FormatLock(NULL) {}
+
+  virtual void HandleDiagnostic(DiagnosticsEngine::Level Level,
+                                const Diagnostic &Info) {
+    DiagnosticConsumer::HandleDiagnostic(Level, Info);
+    Entry E;
+    E.Level = Level;
+    E.Loc = Info.getLocation();
+    {
+      std::unique_lock<std::mutex> Guard;
+      if (FormatLock)
+        Guard = std::unique_lock<std::mutex>(*FormatLock);
+      SmallString<128> Msg;
+      Info.FormatDiagnostic(Msg);
+      E.Message.assign(Msg.begin(), Msg.end());
+    }
+    for (unsigned i = 0; i < Info.getNumRanges(); ++i)
+      E.Ranges.push_back(Info.getRange(i));
+    Entries.push_back(std::move(E));
+  }
+
+  // Report the entries to another engine. They are already formatted, so
+  // each level only needs a "%0" diagnostic.
+  static void Replay(DiagnosticsEngine &D, const std::vector<Entry> &Entries) {
+    for (auto &E : Entries) {
+      unsigned did = D.getCustomDiagID(E.Level, "%0");
+      DiagnosticBuilder B = D.Report(E.Loc, did);
+      B << E.Message;
+      for (auto &R : E.Ranges)
+        B << R;
+    }
+  }
+};
+
+// Collects what checking a declaration depends on beyond its own text: the
+// declarations it refers to and the typedefs it names.
+class DeclDependencies : public RecursiveASTVisitor<DeclDependencies> {
+public:
+  std::vector<const ValueDecl*> Decls;
+  std::vector<QualType> Types;
+
+  bool VisitDeclRefExpr(DeclRefExpr *E) {
+    add(E->getDecl());
+    return true;
+  }
+  bool VisitMemberExpr(MemberExpr *E) {
+    add(E->getMemberDecl());
+    return true;
+  }
+  bool VisitCXXConstructExpr(CXXConstructExpr *E) {
+    add(E->getConstructor());
+    return true;
+  }
+  bool VisitTypedefTypeLoc(TypedefTypeLoc TL) {
+    Types.push_back(TL.getType());
+    return true;
+  }
+
+private:
+  llvm::SmallPtrSet<const ValueDecl*, 16> Seen;
+
+  void add(const ValueDecl *D) {
+    if (Seen.insert(D).second)
+      Decls.push_back(D);
+  }
+};
+
 // Hack to go bottom-up (postorder) on statements.
 template<typename AnnotatorClass>
 class TAVisitor : public RecursiveASTVisitor< TAVisitor<AnnotatorClass> > {
@@ -280,12 +680,50 @@ public:
   AnnotatorClass *Annotator;
   bool SkipHeaders;
 
+  // The per-function budget (see TAOptions) and the body it applies to.
+  unsigned BudgetStmts;
+  unsigned BudgetMillis;
+  bool BudgetConservative;
+  FunctionDecl *BudgetFunc;
+  unsigned Visited;
+  bool OverBudget;
+  std::chrono::steady_clock::time_point BudgetStart;
+
+  // How many bodies ran out of time. Unlike a statement count, that depends
+  // on the machine's load, so their results must not be cached.
+  unsigned TimedOut;
+
+  TAVisitor() :
+    Annotator(NULL),
+    SkipHeaders(false),
+    BudgetStmts(0),
+    BudgetMillis(0),
+    BudgetConservative(false),
+    BudgetFunc(NULL),
+    Visited(0),
+    OverBudget(false),
+    TimedOut(0)
+    {}
+
+  void setBudget(const TAOptions &Opts) {
+    BudgetStmts = Opts.BudgetStmts;
+    BudgetMillis = Opts.BudgetMillis;
+    BudgetConservative = Opts.BudgetConservative;
+  }
+
   bool TraverseStmt(Stmt *S) {
+    // Once a body is over budget, skip the rest of it.
+    if (S && BudgetFunc && overBudget())
+      return true;
+
     // Super traversal: visit children.
     RecursiveASTVisitor<TAVisitor>::TraverseStmt(S);
 
-    // Now give type to parent.
-    if (S) {
+    // Now give type to parent, unless the budget ran out while visiting its
+    // children: some of them may have no types.
+    if (S && !(BudgetFunc && OverBudget)) {
+      if (Annotator->Trace)
+        Annotator->Trace->count("Visit", S->getStmtClassName());
       Annotator->Visit(S);
     }
 
@@ -297,6 +735,11 @@ public:
     if (SkipHeaders) {
       auto Loc = D->getLocation();
       if (Loc.isValid()) {
+        // The SourceManager caches lookups, so parallel workers ask it
+        // under the lock.
+        std::unique_lock<std::mutex> Guard;
+        if (Annotator->ContextLock)
+          Guard = std::unique_lock<std::mutex>(*Annotator->ContextLock);
         auto &Ctx = Annotator->CI.getASTContext();
         if (Ctx.getSourceManager().isInSystemHeader(Loc)) {
           // Do not traverse any children.
@@ -309,12 +752,96 @@ public:
     auto *Func = dyn_cast<FunctionDecl>(D);
     if (Func)
       Annotator->CurFunc = Func;
+    bool Timed = Annotator->Trace && Func && Func->hasBody();
+    TimeTrace::Scope Timer(
+      Timed ? Annotator->Trace : NULL,
+      "Function", Timed ? Func->getQualifiedNameAsString() : ""
+    );
+
+    // Start the budget for an outermost function body. Nested ones (in
+    // local classes, say) share it.
+    bool Budgeted = (BudgetStmts || BudgetMillis) && !BudgetFunc && Func &&
+                    Func->doesThisDeclarationHaveABody();
+    if (Budgeted) {
+      BudgetFunc = Func;
+      Visited = 0;
+      OverBudget = false;
+      BudgetStart = std::chrono::steady_clock::now();
+    }
+
     bool r = RecursiveASTVisitor< TAVisitor<AnnotatorClass> >::TraverseDecl(D);
     if (Func)
       Annotator->CurFunc = NULL;
+
+    if (Budgeted) {
+      if (OverBudget)
+        fallBack(Func);
+      BudgetFunc = NULL;
+    }
+
+    // Global initializers are flows too (local ones come from DeclStmts).
+    auto *Var = dyn_cast<VarDecl>(D);
+    if (Var && Var->isFileVarDecl() && Var->getInit())
+      Annotator->RecordFlow(Var, Var->getInit());
     return r;
   }
 
+  bool VisitValueDecl(ValueDecl *D) {
+    Annotator->CheckDecl(D);
+    return true;
+  }
+
+  // Count a statement against the budget. Reading the clock is cheap, but
+  // not free, so time is only checked every so often.
+  bool overBudget() {
+    if (OverBudget)
+      return true;
+    ++Visited;
+    if (BudgetStmts && Visited > BudgetStmts) {
+      OverBudget = true;
+    } else if (BudgetMillis && Visited % 64 == 0) {
+      auto Elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - BudgetStart
+      ).count();
+      OverBudget = (unsigned long long)Elapsed >= BudgetMillis;
+    }
+    return OverBudget;
+  }
+
+  // Skipping part of a body loses soundness, so always say so. The
+  // conservative fallback also marks the function for code generation,
+  // where passes that enforce a type system at run time (like NullChecks)
+  // can treat all of it as unchecked.
+  void fallBack(FunctionDecl *Func) {
+    if (Annotator->Trace)
+      Annotator->Trace->count("Budget", "functions over budget");
+
+    bool Marked = BudgetConservative && Annotator->Instrument;
+    if (Marked) {
+      Func->addAttr(AnnotateAttr::CreateImplicit(
+        Annotator->CI.getASTContext(), "quala-unchecked", Func->getLocation()
+      ));
+    }
+
+    DiagnosticsEngine &D = Annotator->Diags();
+    unsigned did = D.getCustomDiagID(
+      DiagnosticsEngine::Warning,
+      Marked ? "type checking %0 went over its budget of %1; the rest of "
+               "its body is unchecked and left to run-time checks"
+             : "type checking %0 went over its budget of %1; the rest of "
+               "its body is unchecked"
+    );
+    std::string Budget;
+    llvm::raw_string_ostream OS(Budget);
+    if (BudgetStmts && Visited > BudgetStmts) {
+      OS << BudgetStmts << " statements";
+    } else {
+      OS << BudgetMillis << " ms";
+      ++TimedOut;
+    }
+    D.Report(Func->getLocation(), did) << Func << OS.str();
+  }
+
   // Disable "data recursion", which skips calls to Traverse*.
   bool shouldUseDataRecursionFor(Stmt *S) const { return false; }
 };
@@ -326,16 +853,83 @@ public:
   TAVisitor<AnnotatorClass> Visitor;
   AnnotatorClass Annotator;
   bool Instrument;
+  TAOptions Opts;
+  std::unique_ptr<TimeTrace> Trace;
+  std::unique_ptr<llvm::raw_fd_ostream> SummaryFile;
+  std::unique_ptr<ConstraintSummary> Summary;
+
+  // AST memory allocated while the checker ran. The allocator grows in
+  // slabs, so this is coarse for any one declaration but accurate in total.
+  size_t CheckerMemory;
+
+  // With jobs=N, top-level declarations wait here until the end of the TU
+  // and are then checked on N threads.
+  bool Parallel;
+  std::vector<Decl*> Deferred;
+
+  // With cache=DIR, function results come from (and go to) the cache. The
+  // annotator reports into a buffer so its diagnostics can be stored.
+  std::unique_ptr<CheckCache> Cache;
+  MacroExpansions *Macros;  // Owned by the preprocessor.
+  BufferedDiagnostics CacheBuffer;
+  std::unique_ptr<DiagnosticsEngine> CacheDiags;
+  std::string CacheSalt;  // The part of every key that is the same per TU.
+
+  // A thread's share of a parallel check: an annotator of its own that
+  // keeps types in a side table and buffers its diagnostics.
+  struct Worker {
+    BufferedDiagnostics Buffer;
+    DiagnosticsEngine Diags;
+    llvm::DenseMap<const Expr*, QualType> Types;
+    AnnotatorClass Annotator;
+    TAVisitor<AnnotatorClass> Visitor;
+
+    Worker(CompilerInstance &CI, std::mutex &ContextLock,
+           const TAOptions &Opts) :
+      Diags(new DiagnosticIDs(), &CI.getDiagnosticOpts(), &Buffer, false),
+      Annotator(CI, false)
+    {
+      // Format declaration and type arguments the way Sema's engine does.
+      Diags.SetArgToStringFn(&FormatASTNodeDiagnosticArgument,
+                             &CI.getASTContext());
+      Buffer.FormatLock = &ContextLock;
+      Annotator.Types = &Types;
+      Annotator.DiagEngine = &Diags;
+      Annotator.ContextLock = &ContextLock;
+      Visitor.Annotator = &Annotator;
+      Visitor.setBudget(Opts);
+    }
+  };
 
-  TAConsumer(CompilerInstance &_ci, bool _instrument) :
+  TAConsumer(CompilerInstance &_ci, bool _instrument,
+             const TAOptions &_opts=TAOptions()) :
     CI(_ci),
     Annotator(_ci, _instrument),
-    Instrument(_instrument)
+    Instrument(_instrument),
+    Opts(_opts),
+    CheckerMemory(0),
+    Parallel(false),
+    Macros(NULL)
     {}
 
   virtual void Initialize(ASTContext &Context) {
     Visitor.Annotator = &Annotator;
     Visitor.SkipHeaders = true;  // TODO configurable?
+    Visitor.setBudget(Opts);
+
+    if (!Opts.TimeTraceFile.empty()) {
+      Trace.reset(new TimeTrace());
+      Annotator.Trace = Trace.get();
+    }
+
+    if (!Opts.InferDir.empty())
+      openSummary(Context);
+
+    if (Opts.Jobs != 1)
+      Parallel = canCheckInParallel(Context);
+
+    if (!Opts.CacheDir.empty())
+      openCache(Context);
 
     if (Instrument) {
       // DANGEROUS HACK
@@ -362,11 +956,422 @@ public:
   }
 
   virtual bool HandleTopLevelDecl(DeclGroupRef DG) {
+    ASTContext &Ctx = CI.getASTContext();
+    if (Parallel) {
+      for (auto it : DG) {
+        auto Loc = it->getLocation();
+        if (Loc.isInvalid() || !Ctx.getSourceManager().isInSystemHeader(Loc))
+          Deferred.push_back(it);
+      }
+      return true;
+    }
     for (auto it : DG) {
-      Visitor.TraverseDecl(it);
+      TimeTrace::Scope Timer(Trace.get(), "TopLevelDecl",
+                             Trace ? declName(it) : "");
+      size_t Before = Ctx.getASTAllocatedMemory();
+      if (Cache)
+        checkCached(it);
+      else
+        Visitor.TraverseDecl(it);
+      CheckerMemory += Ctx.getASTAllocatedMemory() - Before;
     }
     return true;
   }
+
+
+  virtual void HandleTranslationUnit(ASTContext &Ctx) {
+    if (Parallel)
+      checkInParallel(Ctx);
+
+    // The frontend may never destroy this consumer (-disable-free).
+    if (SummaryFile)
+      SummaryFile->flush();
+
+    auto &Stats = Annotator.AddStats;
+    if (Opts.MemReport) {
+      size_t Total = Ctx.getASTAllocatedMemory();
+      llvm::errs() << "*** Type checker memory report\n"
+                   << "  AST memory without the checker: "
+                   << (Total - CheckerMemory) << " bytes\n"
+                   << "  AST memory added by the checker: "
+                   << CheckerMemory << " bytes ("
+                   << llvm::format("%.1f", Total ?
+                                   100.0 * CheckerMemory / Total : 0.0)
+                   << "%)\n"
+                   << "  annotations added: " << Stats.Created
+                   << " created, " << Stats.Reused << " reused, "
+                   << Stats.Skipped << " already present\n";
+    }
+
+    if (Trace) {
+      Trace->count("AddAnnotation", "types created", Stats.Created);
+      Trace->count("AddAnnotation", "types reused", Stats.Reused);
+      Trace->count("AddAnnotation", "already annotated", Stats.Skipped);
+      Trace->count("AST memory", "checker bytes", CheckerMemory);
+      if (Cache) {
+        Trace->count("Cache", "hits", Cache->Hits);
+        Trace->count("Cache", "misses", Cache->Misses);
+      }
+
+      std::error_code EC;
+      llvm::raw_fd_ostream OS(Opts.TimeTraceFile, EC, llvm::sys::fs::F_Text);
+      if (EC) {
+        unsigned did = CI.getDiagnostics().getCustomDiagID(
+          DiagnosticsEngine::Error,
+          "cannot write type checker trace '%0': %1"
+        );
+        CI.getDiagnostics().Report(did) << Opts.TimeTraceFile << EC.message();
+      } else {
+        Trace->write(OS);
+      }
+    }
+  }
+
+  // Each TU's summary gets its own file in the inference directory, named
+  // after the main file, so a parallel build can write them all at once.
+  void openSummary(ASTContext &Ctx) {
+    const SourceManager &SM = Ctx.getSourceManager();
+    const FileEntry *Main = SM.getFileEntryForID(SM.getMainFileID());
+
+    // Name the summary by the main file's real path, so that foo.c in two
+    // directories gets two summaries.
+    std::string MainName = Main ?
+        ConstraintSummary::realPath(SM.getFileManager(), Main) : "-";
+
+    SmallString<128> Path(Opts.InferDir);
+    std::string Name;
+    llvm::raw_string_ostream NOS(Name);
+    NOS << llvm::sys::path::filename(MainName) << "-"
+        << llvm::format_hex_no_prefix(llvm::hash_value(MainName), 16)
+        << ".qsum";
+    llvm::sys::path::append(Path, NOS.str());
+
+    std::error_code EC = llvm::sys::fs::create_directories(Opts.InferDir);
+    if (!EC) {
+      SummaryFile.reset(
+        new llvm::raw_fd_ostream(Path, EC, llvm::sys::fs::F_Text)
+      );
+    }
+    if (EC) {
+      SummaryFile.reset();
+      unsigned did = CI.getDiagnostics().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "cannot write inference summary '%0': %1"
+      );
+      CI.getDiagnostics().Report(did) << Path << EC.message();
+      return;
+    }
+    Summary.reset(new ConstraintSummary(Ctx, *SummaryFile));
+    Annotator.Summary = Summary.get();
+  }
+
+  // Waiting for the whole TU only works when nothing (i.e., code generation)
+  // needs the annotations as each declaration goes by. Traces and summaries
+  // are not thread-safe, and neither is loading declarations from a PCH or
+  // module.
+  bool canCheckInParallel(ASTContext &Ctx) {
+    if (CI.getFrontendOpts().ProgramAction == frontend::ParseSyntaxOnly &&
+        !Trace && !Summary && !Ctx.getExternalSource())
+      return true;
+
+    unsigned did = CI.getDiagnostics().getCustomDiagID(
+      DiagnosticsEngine::Warning,
+      "checking serially: jobs=%0 only applies to -fsyntax-only, without "
+      "time-trace or infer, and without a precompiled header"
+    );
+    CI.getDiagnostics().Report(did) << Opts.Jobs;
+    return false;
+  }
+
+  void checkInParallel(ASTContext &Ctx) {
+    unsigned Jobs = Opts.Jobs ? Opts.Jobs : std::thread::hardware_concurrency();
+    Jobs = std::max(1u, std::min<unsigned>(Jobs, Deferred.size()));
+
+    std::mutex ContextLock;
+    std::vector< std::unique_ptr<Worker> > Workers;
+    for (unsigned i = 0; i < Jobs; ++i) {
+      Workers.emplace_back(new Worker(CI, ContextLock, Opts));
+      // Top-level declarations in system headers were never deferred, but
+      // nested ones (in an extern "C" block, say) are filtered here, as
+      // they are when checking serially.
+      Workers.back()->Visitor.SkipHeaders = Visitor.SkipHeaders;
+    }
+
+    // Workers claim declarations one at a time, so a few huge functions
+    // do not hold up the rest. Each declaration's diagnostics are kept
+    // apart for reporting in order.
+    std::vector< std::vector<BufferedDiagnostics::Entry> >
+      Results(Deferred.size());
+
+    // Look up cached results first, on this thread.
+    std::vector<std::string> Keys(Deferred.size());
+    std::vector<SourceLocation> Bases(Deferred.size());
+    std::vector<char> Done(Deferred.size(), false);
+    if (Cache) {
+      for (size_t i = 0; i < Deferred.size(); ++i) {
+        std::vector<CachedDiagnostic> Cached;
+        if (cacheKey(Deferred[i], Keys[i], Bases[i]) &&
+            Cache->lookup(Keys[i], Cached)) {
+          Results[i] = fromCache(Bases[i], Cached);
+          Done[i] = true;
+        }
+      }
+    }
+
+    std::atomic<size_t> Next(0);
+    auto Run = [&](Worker *W) {
+      for (size_t i; (i = Next++) < Deferred.size(); ) {
+        if (Done[i])
+          continue;
+        unsigned TimedOut = W->Visitor.TimedOut;
+        W->Visitor.TraverseDecl(Deferred[i]);
+        Results[i].swap(W->Buffer.Entries);
+        if (W->Visitor.TimedOut != TimedOut)
+          Keys[i].clear();  // Do not cache.
+      }
+    };
+
+    size_t Before = Ctx.getASTAllocatedMemory();
+    std::vector<std::thread> Threads;
+    for (unsigned i = 1; i < Jobs; ++i)
+      Threads.emplace_back(Run, Workers[i].get());
+    Run(Workers[0].get());
+    for (auto &T : Threads)
+      T.join();
+    CheckerMemory += Ctx.getASTAllocatedMemory() - Before;
+
+    for (size_t i = 0; i < Deferred.size(); ++i) {
+      if (!Done[i] && !Keys[i].empty())
+        storeInCache(Keys[i], Bases[i], Deferred[i], Results[i]);
+      BufferedDiagnostics::Replay(CI.getDiagnostics(), Results[i]);
+    }
+    for (auto &W : Workers) {
+      Annotator.AddStats.Skipped += W->Annotator.AddStats.Skipped;
+      Annotator.AddStats.Reused += W->Annotator.AddStats.Reused;
+      Annotator.AddStats.Created += W->Annotator.AddStats.Created;
+    }
+    Deferred.clear();
+  }
+
+  // Results can only be reused when nothing else needs the annotations the
+  // checker would have added, i.e., when not generating code. Inference
+  // summaries need every body visited, too.
+  void openCache(ASTContext &Ctx) {
+    if (CI.getFrontendOpts().ProgramAction != frontend::ParseSyntaxOnly ||
+        Summary) {
+      unsigned did = CI.getDiagnostics().getCustomDiagID(
+        DiagnosticsEngine::Warning,
+        "not caching in '%0': cache= needs -fsyntax-only and no infer"
+      );
+      CI.getDiagnostics().Report(did) << Opts.CacheDir;
+      return;
+    }
+
+    Cache.reset(new CheckCache(Opts.CacheDir));
+    CacheSalt = cacheSalt();
+    Macros = new MacroExpansions(CI.getSourceManager(), CI.getLangOpts());
+    CI.getPreprocessor().addPPCallbacks(std::unique_ptr<PPCallbacks>(Macros));
+
+    CacheDiags.reset(new DiagnosticsEngine(
+      new DiagnosticIDs(), &CI.getDiagnosticOpts(), &CacheBuffer, false
+    ));
+    CacheDiags->SetArgToStringFn(&FormatASTNodeDiagnosticArgument, &Ctx);
+    Annotator.DiagEngine = CacheDiags.get();
+  }
+
+  // Check a declaration, or replay its diagnostics from the cache.
+  void checkCached(Decl *D) {
+    std::string Key;
+    SourceLocation Base;
+    std::vector<CachedDiagnostic> Cached;
+    bool Keyed = cacheKey(D, Key, Base);
+    if (Keyed && Cache->lookup(Key, Cached)) {
+      BufferedDiagnostics::Replay(CI.getDiagnostics(), fromCache(Base, Cached));
+      return;
+    }
+
+    unsigned TimedOut = Visitor.TimedOut;
+    Visitor.TraverseDecl(D);
+    if (Keyed && Visitor.TimedOut == TimedOut)
+      storeInCache(Key, Base, D, CacheBuffer.Entries);
+    BufferedDiagnostics::Replay(CI.getDiagnostics(), CacheBuffer.Entries);
+    CacheBuffer.Entries.clear();
+  }
+
+  // The cache key for a function definition: a hash of the checker, the
+  // function's text, the macros it expands, and the annotated types of
+  // everything it refers to. The checker's part includes the plugin
+  // arguments, so results truncated by a statement budget (which are
+  // deterministic) only replay under the same budget. Other declarations
+  // are always checked.
+  bool cacheKey(Decl *D, std::string &Key, SourceLocation &Base) {
+    auto *FD = dyn_cast<FunctionDecl>(D);
+    if (!FD || !FD->doesThisDeclarationHaveABody())
+      return false;
+
+    SourceManager &SM = CI.getSourceManager();
+    SourceLocation B = SM.getExpansionLoc(D->getLocStart());
+    SourceLocation E = SM.getExpansionRange(D->getLocEnd()).second;
+    if (B.isInvalid() || E.isInvalid() || SM.isInSystemHeader(B))
+      return false;
+    FileID File = SM.getFileID(B);
+    if (SM.getFileID(E) != File)
+      return false;
+    unsigned BOff = SM.getFileOffset(B);
+    unsigned EOff = SM.getFileOffset(E) +
+                    Lexer::MeasureTokenLength(E, SM, CI.getLangOpts());
+    bool Invalid = false;
+    StringRef Buf = SM.getBufferData(File, &Invalid);
+    if (Invalid || EOff > Buf.size())
+      return false;
+
+    llvm::MD5 H;
+    H.update(CacheSalt);
+    H.update(Buf.slice(BOff, EOff));
+    Macros->hash(B, E, H);
+
+    DeclDependencies Deps;
+    Deps.TraverseDecl(FD);
+    for (auto *VD : Deps.Decls) {
+      H.update("\ndecl ");
+      H.update(VD->getQualifiedNameAsString());
+      hashType(VD->getType(), H);
+      if (auto *Callee = dyn_cast<FunctionDecl>(VD)) {
+        for (auto *P : Callee->params())
+          hashType(P->getType(), H);
+      }
+    }
+    for (QualType T : Deps.Types) {
+      H.update("\ntype ");
+      hashType(T, H);
+    }
+
+    llvm::MD5::MD5Result Res;
+    H.final(Res);
+    SmallString<32> Hex;
+    llvm::MD5::stringifyResult(Res, Hex);
+    Key = Hex.str().str();
+    Base = B;
+    return true;
+  }
+
+  // What keys have in common within a TU: the checker (the annotator class
+  // and the plugin build it comes from), the language options (which tell
+  // C from C++, among other things), and the plugin arguments.
+  std::string cacheSalt() {
+    std::string Salt;
+    llvm::raw_string_ostream OS(Salt);
+    OS << CheckCache::version() << "\n" << __PRETTY_FUNCTION__ << "\n"
+       << checkerBuild() << "\n";
+
+    const LangOptions &LO = CI.getLangOpts();
+#define LANGOPT(Name, Bits, Default, Description) \
+    OS << LO.Name << ",";
+#define ENUM_LANGOPT(Name, Type, Bits, Default, Description) \
+    OS << (unsigned)LO.get##Name() << ",";
+#include "clang/Basic/LangOptions.def"
+
+    for (auto &Arg : Opts.ResultArgs)
+      OS << "\n" << Arg;
+    return OS.str();
+  }
+
+  // The checker plugin's build, computed once per process.
+  static const std::string &checkerBuild() {
+    static const std::string Hash = CheckCache::hashBinaryOf(
+      reinterpret_cast<const void*>(&checkerBuild)
+    );
+    return Hash;
+  }
+
+  // Hash a type along with its annotations at every level (and those of
+  // its parameters and result, for a function type).
+  void hashType(QualType T, llvm::MD5 &H, unsigned Depth=0) {
+    H.update(T.getCanonicalType().getAsString());
+    for (QualType L = T; ; ) {
+      H.update("|");
+      H.update(Annotator.AnnotationOf(L));
+      if (L->isPointerType() || L->isReferenceType()) {
+        L = L->getPointeeType();
+      } else if (auto *AT = L->getAsArrayTypeUnsafe()) {
+        L = AT->getElementType();
+      } else {
+        break;
+      }
+    }
+    if (Depth < 2) {
+      if (auto *FT = T->getAs<FunctionProtoType>()) {
+        hashType(FT->getReturnType(), H, Depth + 1);
+        for (QualType P : FT->param_types())
+          hashType(P, H, Depth + 1);
+      }
+    }
+  }
+
+  // Cached diagnostics are relative to the start of their function. A
+  // diagnostic elsewhere (or without a location) makes the result
+  // uncacheable.
+  void storeInCache(StringRef Key, SourceLocation Base, Decl *D,
+                    const std::vector<BufferedDiagnostics::Entry> &Entries) {
+    SourceManager &SM = CI.getSourceManager();
+    SourceLocation End = SM.getExpansionRange(D->getLocEnd()).second;
+    auto Offset = [&](SourceLocation Loc, unsigned &Off) {
+      if (Loc.isInvalid())
+        return false;
+      Loc = SM.getFileLoc(Loc);
+      if (SM.getFileID(Loc) != SM.getFileID(Base) ||
+          SM.isBeforeInTranslationUnit(Loc, Base) ||
+          SM.isBeforeInTranslationUnit(End, Loc))
+        return false;
+      Off = SM.getFileOffset(Loc) - SM.getFileOffset(Base);
+      return true;
+    };
+
+    std::vector<CachedDiagnostic> Cached;
+    for (auto &E : Entries) {
+      CachedDiagnostic CD;
+      CD.Level = E.Level;
+      CD.Message = E.Message;
+      if (!Offset(E.Loc, CD.Offset) ||
+          CD.Message.find('\n') != std::string::npos)
+        return;
+      for (auto &R : E.Ranges) {
+        CachedDiagnostic::Range CR;
+        CR.IsTokenRange = R.isTokenRange();
+        if (Offset(R.getBegin(), CR.Begin) && Offset(R.getEnd(), CR.End))
+          CD.Ranges.push_back(CR);
+      }
+      Cached.push_back(CD);
+    }
+    Cache->store(Key, Cached);  // Best effort: just check again next time.
+  }
+
+  std::vector<BufferedDiagnostics::Entry>
+  fromCache(SourceLocation Base, const std::vector<CachedDiagnostic> &Cached) {
+    std::vector<BufferedDiagnostics::Entry> Entries;
+    for (auto &CD : Cached) {
+      BufferedDiagnostics::Entry E;
+      E.Level = CD.Level;
+      E.Loc = Base.getLocWithOffset(CD.Offset);
+      E.Message = CD.Message;
+      for (auto &CR : CD.Ranges) {
+        E.Ranges.push_back(CharSourceRange(
+          SourceRange(Base.getLocWithOffset(CR.Begin),
+                      Base.getLocWithOffset(CR.End)),
+          CR.IsTokenRange
+        ));
+      }
+      Entries.push_back(E);
+    }
+    return Entries;
+  }
+
+  // A name for a declaration in traces.
+  static std::string declName(Decl *D) {
+    if (auto *ND = dyn_cast<NamedDecl>(D))
+      return ND->getQualifiedNameAsString();
+    return D->getDeclKindName();
+  }
 };
 
 }
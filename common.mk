@@ -7,26 +7,30 @@ LLVM_CONFIG := $(BUILT)/bin/llvm-config
 LLVM_CXXFLAGS := $(shell $(LLVM_CONFIG) --cxxflags) -fno-rtti
 LLVM_LDFLAGS := $(shell $(LLVM_CONFIG) --ldflags)
 LLVM_LIBS := $(shell $(LLVM_CONFIG) --libs --system-libs)
+# In link order: each library comes before the ones it depends on.
 CLANG_LIBS := \
-	-lclangAST \
-	-lclangAnalysis \
-	-lclangBasic \
-	-lclangDriver \
-	-lclangEdit \
-	-lclangFrontend \
 	-lclangFrontendTool \
-	-lclangLex \
-	-lclangParse \
-	-lclangSema \
-	-lclangEdit \
-	-lclangASTMatchers \
-	-lclangRewriteCore \
+	-lclangCodeGen \
+	-lclangARCMigrate \
 	-lclangRewriteFrontend \
 	-lclangStaticAnalyzerFrontend \
 	-lclangStaticAnalyzerCheckers \
 	-lclangStaticAnalyzerCore \
+	-lclangTooling \
+	-lclangToolingCore \
+	-lclangFormat \
+	-lclangFrontend \
+	-lclangDriver \
 	-lclangSerialization \
-	-lclangTooling
+	-lclangParse \
+	-lclangSema \
+	-lclangEdit \
+	-lclangRewrite \
+	-lclangAnalysis \
+	-lclangASTMatchers \
+	-lclangAST \
+	-lclangLex \
+	-lclangBasic
 
 # On OS X, you need to tell the linker that undefined symbols will be looked
 # up at runtime.
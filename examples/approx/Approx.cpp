@@ -0,0 +1,154 @@
+#include "TypeAnnotations.h"
+
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/Support/raw_ostream.h"
+#include "clang/Basic/Builtins.h"
+using namespace clang;
+
+namespace {
+
+#define APPROX_ANN "approx"
+#define PRECISE_ANN "precise"
+
+class ApproxAnnotator: public Annotator<ApproxAnnotator> {
+public:
+  ApproxAnnotator(CompilerInstance &ci, bool instrument)
+      : Annotator(ci, instrument) {};
+
+  // Check whether an expression or type has the "approx" annotation.
+  template <typename T>
+  bool approx(const T V) const {
+    return AnnotationOf(V).equals(APPROX_ANN);
+  }
+
+  // Type rule for binary-operator expressions: an operation on any
+  // approximate operand is approximate.
+  void VisitBinaryOperator(BinaryOperator *E) {
+    if (approx(E->getLHS()) || approx(E->getRHS())) {
+      AddAnnotation(E, APPROX_ANN);
+    }
+  }
+
+  void VisitUnaryOperator(UnaryOperator *E) {
+    if (E->getOpcode() == UO_Deref) {
+      checkAddress(E->getSubExpr());
+    } else if (E->getOpcode() != UO_AddrOf) {
+      AddAnnotation(E, AnnotationOf(E->getSubExpr()));
+    }
+  }
+
+  // Explicit casts do not make a value precise; only endorsements do. That
+  // goes for C++'s static_cast<T>(e), T(e), and T{e} as well as C casts.
+  void VisitExplicitCastExpr(ExplicitCastExpr *E) {
+    Expr *Sub = E->getSubExpr();
+    auto *List = dyn_cast<InitListExpr>(Sub);
+    if (List && List->getNumInits() == 1)
+      Sub = List->getInit(0);
+    if (!AnnotationOf(E).size() && approx(Sub)) {
+      AddAnnotation(E, APPROX_ANN);
+    }
+  }
+
+  // Subtyping judgment.
+  bool Compatible(QualType LTy, QualType RTy) {
+    // Top-level annotation: disallow approx-to-precise flow.
+    if (approx(RTy) && !approx(LTy)) {
+      return false;
+    }
+    return CheckPointerInvariance(LTy, RTy);
+  }
+
+  // Endorsements.
+  void VisitCallExpr(CallExpr *E) {
+    unsigned biid = E->getBuiltinCallee();
+    if (biid == Builtin::BI__builtin_annotation) {
+      auto *literal = cast<StringLiteral>(E->getArg(1));
+      if (literal->getString() == "endorse") {
+        // Mask any "approx" annotation buried under typedefs (see the
+        // tainting example).
+        RemoveAnnotation(E);
+        AddAnnotation(E, PRECISE_ANN);
+      }
+    }
+    Annotator<ApproxAnnotator>::VisitCallExpr(E);
+  }
+
+  // Approximate data must not decide control flow or which memory is
+  // accessed.
+  void VisitIfStmt(IfStmt *S) {
+    checkCondition(S->getCond());
+  }
+  void VisitForStmt(ForStmt *S) {
+    checkCondition(S->getCond());
+  }
+  void VisitWhileStmt(WhileStmt *S) {
+    checkCondition(S->getCond());
+  }
+  void VisitDoStmt(DoStmt *S) {
+    checkCondition(S->getCond());
+  }
+  void VisitSwitchStmt(SwitchStmt *S) {
+    checkCondition(S->getCond());
+  }
+  void VisitConditionalOperator(ConditionalOperator *E) {
+    checkCondition(E->getCond());
+    if (approx(E->getTrueExpr()) || approx(E->getFalseExpr())) {
+      AddAnnotation(E, APPROX_ANN);
+    }
+  }
+  // In `a ?: b`, the condition and true arm are opaque references to the
+  // common expression `a`, which carries the type.
+  void VisitBinaryConditionalOperator(BinaryConditionalOperator *E) {
+    checkCondition(E->getCommon());
+    if (approx(E->getCommon()) || approx(E->getFalseExpr())) {
+      AddAnnotation(E, APPROX_ANN);
+    }
+  }
+  void VisitArraySubscriptExpr(ArraySubscriptExpr *E) {
+    checkAddress(E->getBase());
+    checkAddress(E->getIdx());
+  }
+
+  void checkCondition(Expr *E) {
+    if (E && approx(E)) {
+      unsigned did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "approximate condition"
+      );
+      Diags().Report(E->getLocStart(), did)
+          << CharSourceRange(E->getSourceRange(), false);
+    }
+  }
+  void checkAddress(Expr *E) {
+    if (approx(E)) {
+      unsigned did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "approximate address"
+      );
+      Diags().Report(E->getLocStart(), did)
+          << CharSourceRange(E->getSourceRange(), false);
+    }
+  }
+};
+
+class ApproxAction : public PluginASTAction {
+protected:
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 llvm::StringRef) {
+    // Construct a type checker for our type system.
+    return llvm::make_unique< TAConsumer<ApproxAnnotator> >(CI, true, Opts);
+  }
+
+  bool ParseArgs(const CompilerInstance &CI,
+                 const std::vector<std::string>& args) {
+    return Opts.Parse(CI, args);
+  }
+
+  TAOptions Opts;
+};
+
+}
+
+static FrontendPluginRegistry::Add<ApproxAction>
+X("approx", "approximate computing type system");
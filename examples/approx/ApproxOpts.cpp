@@ -0,0 +1,175 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+
+#include "AnnotationInfo.h"
+
+#define DEBUG_TYPE "quala-approx"
+
+using namespace llvm;
+
+STATISTIC(NumFastMath, "Number of approximate operations made fast-math");
+STATISTIC(NumNarrowed, "Number of approximate operations narrowed to float");
+
+namespace {
+
+cl::opt<bool> ApproxFastMath("quala-approx-fast-math",
+    cl::desc("Allow fast-math reassociation in approximate arithmetic"),
+    cl::init(true));
+
+cl::opt<bool> ApproxNarrow("quala-approx-narrow",
+    cl::desc("Compute approximate double arithmetic in single precision"),
+    cl::init(false));
+
+// Floating-point arithmetic that only affects approximate data can be
+// computed less precisely. The checker guarantees that approximate values
+// never reach precise data, control flow, or addresses, so an operation is
+// approximate if:
+//
+// * one of its operands is approximate (the checker types its result as
+//   approximate, too), or
+// * all of its uses are approximate (it only feeds approximate data).
+//
+// Approximate values enter through loads and stores annotated `approx`,
+// which is where Clang puts the annotations. This runs before mem2reg
+// removes them.
+struct ApproxOpts : public FunctionPass {
+  static char ID;
+  ApproxOpts() : FunctionPass(ID) {}
+
+  virtual void getAnalysisUsage(AnalysisUsage &Info) const {
+    Info.addRequired<AnnotationInfo>();
+    Info.setPreservesCFG();
+  }
+
+  virtual bool runOnFunction(Function &F) {
+    AnnotationInfo &AI = getAnalysis<AnnotationInfo>();
+    SmallPtrSet<Value*, 32> Approx;
+    findApprox(F, AI, Approx);
+
+    // Collect first: narrowing replaces instructions.
+    SmallVector<Instruction*, 32> Ops;
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (isArith(&I) && Approx.count(&I))
+          Ops.push_back(&I);
+      }
+    }
+
+    for (Instruction *I : Ops) {
+      if (ApproxFastMath) {
+        FastMathFlags FMF;
+        FMF.setUnsafeAlgebra();
+        I->setFastMathFlags(FMF);
+        ++NumFastMath;
+      }
+      if (ApproxNarrow && I->getType()->isDoubleTy()) {
+        narrow(I);
+        ++NumNarrowed;
+      }
+    }
+
+    return !Ops.empty() && (ApproxFastMath || ApproxNarrow);
+  }
+
+  static bool isArith(Value *V) {
+    auto *BO = dyn_cast<BinaryOperator>(V);
+    return BO && BO->getType()->isFloatingPointTy();
+  }
+
+  bool isApproxSink(AnnotationInfo &AI, User *U, Value *V) {
+    auto *SI = dyn_cast<StoreInst>(U);
+    if (!SI || SI->getValueOperand() != V)
+      return false;
+    return AI.hasAnnotation(SI, "approx") ||
+           AI.hasAnnotation(SI->getPointerOperand(), "approx", 1);
+  }
+
+  void findApprox(Function &F, AnnotationInfo &AI,
+                  SmallPtrSetImpl<Value*> &Approx) {
+    // Forward, from values typed approximate. Before mem2reg, values cross
+    // blocks through memory, so one pass in block order finds nearly all
+    // of them. Anything missed just stays precise.
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (isa<LoadInst>(&I) && AI.hasAnnotation(&I, "approx")) {
+          Approx.insert(&I);
+        } else if (isa<BinaryOperator>(&I) || isa<CastInst>(&I)) {
+          for (auto &Op : I.operands()) {
+            if (Approx.count(Op)) {
+              Approx.insert(&I);
+              break;
+            }
+          }
+        }
+      }
+    }
+
+    // Backward, from approximate stores. Only uses that are approximate
+    // by type (or by this rule) count, never ones that are only
+    // approximate because of this operation.
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto &BB : F) {
+        for (auto &I : BB) {
+          if (!isArith(&I) || Approx.count(&I) || I.use_empty())
+            continue;
+          bool AllApprox = true;
+          for (auto *U : I.users()) {
+            if (!isApproxSink(AI, U, &I) &&
+                !(isArith(U) && Approx.count(U))) {
+              AllApprox = false;
+              break;
+            }
+          }
+          if (AllApprox) {
+            Approx.insert(&I);
+            changed = true;
+          }
+        }
+      }
+    }
+  }
+
+  // Compute a double operation in float. InstCombine removes the
+  // conversions between chained operations.
+  void narrow(Instruction *I) {
+    auto *BO = cast<BinaryOperator>(I);
+    IRBuilder<> Bld(BO);
+    Type *FloatTy = Bld.getFloatTy();
+    Value *L = Bld.CreateFPTrunc(BO->getOperand(0), FloatTy);
+    Value *R = Bld.CreateFPTrunc(BO->getOperand(1), FloatTy);
+    Value *N = Bld.CreateBinOp(BO->getOpcode(), L, R);
+    if (auto *NI = dyn_cast<Instruction>(N))
+      NI->copyFastMathFlags(BO);
+    Value *Ext = Bld.CreateFPExt(N, BO->getType());
+    Ext->takeName(BO);
+    BO->replaceAllUsesWith(Ext);
+    BO->eraseFromParent();
+  }
+};
+
+}
+
+char ApproxOpts::ID = 0;
+static RegisterPass<ApproxOpts> X("approx-opts",
+                                  "approximate arithmetic optimizations",
+                                  true,
+                                  false);
+
+static void registerPass(const PassManagerBuilder &,
+                         legacy::PassManagerBase &PM) {
+  PM.add(new ApproxOpts());
+}
+static RegisterStandardPasses
+  RegisterMyPass(PassManagerBuilder::EP_EarlyAsPossible,
+                 registerPass);
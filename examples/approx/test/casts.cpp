@@ -0,0 +1,25 @@
+// RUN: clang++ -fsyntax-only -Xclang -verify %s
+
+#define APPROX __attribute__((type_annotate("approx")))
+#define ENDORSE(e) __builtin_annotation((e), "endorse")
+
+// No C++ cast makes approximate data precise.
+double casts(APPROX int sum) {
+  double a = static_cast<double>(sum);  // expected-error {{incompatible}}
+  double b = double(sum);  // expected-error {{incompatible}}
+  double c = double{sum};  // expected-error {{incompatible}}
+  double d = (double)sum;  // expected-error {{incompatible}}
+  APPROX double e = static_cast<double>(sum);
+  int f = ENDORSE(static_cast<int>(sum));
+  if (static_cast<bool>(sum))  // expected-error {{approximate condition}}
+    return 1.0;
+  return a + b + c + d + f;
+}
+
+// `a ?: b` is approximate if either arm is.
+int elvis(APPROX int a, int b) {
+  int c = a ?: b;  // expected-error {{approximate condition}} expected-error {{incompatible}}
+  int d = b ?: a;  // expected-error {{incompatible}}
+  APPROX int e = b ?: a;
+  return c + d + e;
+}
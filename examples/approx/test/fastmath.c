@@ -0,0 +1,26 @@
+// RUN: clang -emit-llvm -S -o - %s | FileCheck %s
+// RUN: clang -mllvm -quala-approx-narrow -emit-llvm -S -o - %s | FileCheck --check-prefix=NARROW %s
+
+#define APPROX __attribute__((type_annotate("approx")))
+
+// CHECK-LABEL: define double @dot(
+// NARROW-LABEL: define double @dot(
+double dot(APPROX double *a, APPROX double *b, int n) {
+  APPROX double sum = 0.0;
+  for (int i = 0; i < n; ++i) {
+    // CHECK: fmul fast double
+    // CHECK: fadd fast double
+    // NARROW: fmul fast float
+    // NARROW: fadd fast float
+    sum += a[i] * b[i];
+  }
+  return 0.0;
+}
+
+// Precise arithmetic stays precise.
+// CHECK-LABEL: define double @precise(
+// CHECK-NOT: fast
+// CHECK: ret double
+double precise(double x, double y) {
+  return x * y + 1.0;
+}
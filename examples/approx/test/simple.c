@@ -0,0 +1,33 @@
+// RUN: clang -fsyntax-only -Xclang -verify %s
+
+#define APPROX __attribute__((type_annotate("approx")))
+#define ENDORSE(e) __builtin_annotation((e), "endorse")
+
+double mean(APPROX double *xs, int n) {  // Pointer to approximate data.
+  APPROX double sum = 0.0;
+  for (int i = 0; i < n; ++i)
+    sum += xs[i];
+  double precise = sum / n;  // expected-error {{incompatible}}
+  return (double)sum;  // expected-error {{incompatible}}
+}
+
+int main() {
+  APPROX int a = 5;
+  APPROX double x = 1.0;
+  int b = 10;
+  int table[10];
+
+  a = b;
+  b = a;  // expected-error {{incompatible}}
+  b = ENDORSE(a);
+  x = x * 2.0;
+
+  if (a)  // expected-error {{approximate condition}}
+    b = 1;
+  while (x < 2.0)  // expected-error {{approximate condition}}
+    x += 1.0;
+  b = a > 3 ? 1 : 2;  // expected-error {{approximate condition}}
+  b = table[a];  // expected-error {{approximate address}}
+
+  return 0;
+}
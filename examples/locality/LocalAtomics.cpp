@@ -0,0 +1,238 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+
+#include "AnnotationInfo.h"
+
+#define DEBUG_TYPE "quala-locality"
+
+using namespace llvm;
+
+STATISTIC(NumDemoted, "Number of atomic operations on local data made plain");
+
+namespace {
+
+const char *const LocalAnn = "local";
+
+// The checker's `annotate` attributes (see Locality.cpp).
+const char *const LocalAttr = "quala-local";
+const char *const LocalPointeeAttr = "quala-local-pointee";
+
+// The string an annotation intrinsic or llvm.global.annotations entry
+// refers to.
+StringRef annotationString(Value *V) {
+  auto *GV = dyn_cast<GlobalVariable>(V->stripPointerCasts());
+  if (!GV || !GV->hasInitializer())
+    return StringRef();
+  auto *Str = dyn_cast<ConstantDataArray>(GV->getInitializer());
+  if (!Str || !Str->isCString())
+    return StringRef();
+  return Str->getAsCString();
+}
+
+// The checker guarantees that no other thread can reach `local` data, so
+// atomic operations on it need no atomicity and no ordering: no other
+// thread can observe them, or synchronize through them. This pass turns
+// them into plain operations:
+//
+// * Atomic loads and stores lose their ordering.
+// * Read-modify-writes become a load, the operation, and a store.
+// * Compare-and-swaps become a load, a compare, and a store of the selected
+//   value.
+//
+// Local data is memory based on a local variable (whose alloca Clang
+// annotates), on a pointer loaded from a variable declared to point to
+// local data, or on a thread-local global declared local. Fences are left
+// alone: they order every access, including those to shared data. So are
+// volatile operations.
+//
+// This runs before mem2reg removes the annotated allocas.
+struct LocalAtomics : public FunctionPass {
+  static char ID;
+  LocalAtomics() : FunctionPass(ID) {}
+
+  SmallPtrSet<const Value*, 8> LocalGlobals;
+
+  virtual void getAnalysisUsage(AnalysisUsage &Info) const {
+    Info.addRequired<AnnotationInfo>();
+    Info.setPreservesCFG();
+  }
+
+  virtual bool doInitialization(Module &M) {
+    LocalGlobals.clear();
+    GlobalVariable *Anns = M.getNamedGlobal("llvm.global.annotations");
+    if (!Anns || !Anns->hasInitializer())
+      return false;
+    auto *Entries = dyn_cast<ConstantArray>(Anns->getInitializer());
+    if (!Entries)
+      return false;
+    for (auto &Op : Entries->operands()) {
+      auto *Entry = dyn_cast<ConstantStruct>(Op);
+      if (Entry && Entry->getNumOperands() >= 2 &&
+          annotationString(Entry->getOperand(1)) == LocalAttr)
+        LocalGlobals.insert(Entry->getOperand(0)->stripPointerCasts());
+    }
+    return false;
+  }
+
+  virtual bool runOnFunction(Function &F) {
+    AnnotationInfo &AI = getAnalysis<AnnotationInfo>();
+    const DataLayout &DL = F.getParent()->getDataLayout();
+
+    // Variables whose values point to local data.
+    SmallPtrSet<Value*, 8> Slots;
+    SmallVector<Instruction*, 16> Atomics;
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (auto *II = dyn_cast<IntrinsicInst>(&I)) {
+          if (II->getIntrinsicID() == Intrinsic::var_annotation &&
+              annotationString(II->getArgOperand(1)) == LocalPointeeAttr)
+            Slots.insert(II->getArgOperand(0)->stripPointerCasts());
+        } else if (auto *LI = dyn_cast<LoadInst>(&I)) {
+          if (LI->isAtomic() && !LI->isVolatile())
+            Atomics.push_back(LI);
+        } else if (auto *SI = dyn_cast<StoreInst>(&I)) {
+          if (SI->isAtomic() && !SI->isVolatile())
+            Atomics.push_back(SI);
+        } else if (auto *RMW = dyn_cast<AtomicRMWInst>(&I)) {
+          if (!RMW->isVolatile())
+            Atomics.push_back(RMW);
+        } else if (auto *CX = dyn_cast<AtomicCmpXchgInst>(&I)) {
+          if (!CX->isVolatile())
+            Atomics.push_back(CX);
+        }
+      }
+    }
+
+    bool modified = false;
+    for (Instruction *I : Atomics) {
+      if (isLocal(AI, DL, Slots, pointerOperand(I)) && demote(I)) {
+        ++NumDemoted;
+        modified = true;
+      }
+    }
+    return modified;
+  }
+
+  static Value *pointerOperand(Instruction *I) {
+    if (auto *LI = dyn_cast<LoadInst>(I))
+      return LI->getPointerOperand();
+    if (auto *SI = dyn_cast<StoreInst>(I))
+      return SI->getPointerOperand();
+    if (auto *RMW = dyn_cast<AtomicRMWInst>(I))
+      return RMW->getPointerOperand();
+    return cast<AtomicCmpXchgInst>(I)->getPointerOperand();
+  }
+
+  bool isLocal(AnnotationInfo &AI, const DataLayout &DL,
+               SmallPtrSetImpl<Value*> &Slots, Value *Ptr) {
+    Value *Obj = GetUnderlyingObject(Ptr, DL);
+    if (isa<AllocaInst>(Obj))
+      return AI.hasAnnotation(Obj, LocalAnn, 1);
+    if (auto *LI = dyn_cast<LoadInst>(Obj))
+      return Slots.count(LI->getPointerOperand()->stripPointerCasts());
+    return LocalGlobals.count(Obj);
+  }
+
+  bool demote(Instruction *I) {
+    if (auto *LI = dyn_cast<LoadInst>(I)) {
+      LI->setAtomic(NotAtomic);
+      return true;
+    }
+    if (auto *SI = dyn_cast<StoreInst>(I)) {
+      SI->setAtomic(NotAtomic);
+      return true;
+    }
+
+    IRBuilder<> Bld(I);
+    if (auto *RMW = dyn_cast<AtomicRMWInst>(I)) {
+      Value *Ptr = RMW->getPointerOperand();
+      Value *Val = RMW->getValOperand();
+      LoadInst *Old = Bld.CreateLoad(Ptr, "local.old");
+      Value *New;
+      switch (RMW->getOperation()) {
+      case AtomicRMWInst::Xchg:
+        New = Val;
+        break;
+      case AtomicRMWInst::Add:
+        New = Bld.CreateAdd(Old, Val);
+        break;
+      case AtomicRMWInst::Sub:
+        New = Bld.CreateSub(Old, Val);
+        break;
+      case AtomicRMWInst::And:
+        New = Bld.CreateAnd(Old, Val);
+        break;
+      case AtomicRMWInst::Nand:
+        New = Bld.CreateNot(Bld.CreateAnd(Old, Val));
+        break;
+      case AtomicRMWInst::Or:
+        New = Bld.CreateOr(Old, Val);
+        break;
+      case AtomicRMWInst::Xor:
+        New = Bld.CreateXor(Old, Val);
+        break;
+      case AtomicRMWInst::Max:
+        New = Bld.CreateSelect(Bld.CreateICmpSGT(Old, Val), Old, Val);
+        break;
+      case AtomicRMWInst::Min:
+        New = Bld.CreateSelect(Bld.CreateICmpSLT(Old, Val), Old, Val);
+        break;
+      case AtomicRMWInst::UMax:
+        New = Bld.CreateSelect(Bld.CreateICmpUGT(Old, Val), Old, Val);
+        break;
+      case AtomicRMWInst::UMin:
+        New = Bld.CreateSelect(Bld.CreateICmpULT(Old, Val), Old, Val);
+        break;
+      default:
+        Old->eraseFromParent();
+        return false;
+      }
+      Bld.CreateStore(New, Ptr);
+      RMW->replaceAllUsesWith(Old);
+      RMW->eraseFromParent();
+      return true;
+    }
+
+    // The original stores only on success; storing the old value back on
+    // failure is equivalent when nobody else can look.
+    auto *CX = cast<AtomicCmpXchgInst>(I);
+    Value *Ptr = CX->getPointerOperand();
+    LoadInst *Old = Bld.CreateLoad(Ptr, "local.old");
+    Value *Success = Bld.CreateICmpEQ(Old, CX->getCompareOperand());
+    Bld.CreateStore(Bld.CreateSelect(Success, CX->getNewValOperand(), Old),
+                    Ptr);
+    Value *Res = UndefValue::get(CX->getType());
+    Res = Bld.CreateInsertValue(Res, Old, 0);
+    Res = Bld.CreateInsertValue(Res, Success, 1);
+    CX->replaceAllUsesWith(Res);
+    CX->eraseFromParent();
+    return true;
+  }
+};
+
+}
+
+char LocalAtomics::ID = 0;
+static RegisterPass<LocalAtomics> X("local-atomics",
+                                    "make atomics on thread-local data plain",
+                                    false,
+                                    false);
+
+static void registerPass(const PassManagerBuilder &,
+                         legacy::PassManagerBase &PM) {
+  PM.add(new LocalAtomics());
+}
+static RegisterStandardPasses
+  RegisterMyPass(PassManagerBuilder::EP_EarlyAsPossible,
+                 registerPass);
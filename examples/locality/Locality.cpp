@@ -0,0 +1,275 @@
+#include "TypeAnnotations.h"
+
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/AST/Attr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "clang/Basic/Builtins.h"
+using namespace clang;
+
+namespace {
+
+#define LOCAL_ANN "local"
+#define FRESH_ANN "fresh"
+
+// How the checker tells LocalAtomics about memory that the IR's `tyann`
+// metadata cannot describe (see CheckDecl).
+#define LOCAL_ATTR "quala-local"
+#define LOCAL_POINTEE_ATTR "quala-local-pointee"
+
+class LocalityAnnotator: public Annotator<LocalityAnnotator> {
+public:
+  LocalityAnnotator(CompilerInstance &ci, bool instrument)
+      : Annotator(ci, instrument) {};
+
+  template <typename T>
+  bool local(const T V) const {
+    return AnnotationOf(V).equals(LOCAL_ANN);
+  }
+
+  // Fresh pointers (null and newly allocated memory) are not shared with
+  // anyone yet, so they may point to local data.
+  template <typename T>
+  bool fresh(const T V) const {
+    return AnnotationOf(V).equals(FRESH_ANN);
+  }
+
+  // Only the checker may call a pointer fresh. A type written with "fresh"
+  // would let shared data into a pointer to local data, so reject it
+  // wherever a type is spelled.
+  bool spelledFresh(QualType T, SourceLocation Loc) const {
+    if (!SpellsAnnotation(T, FRESH_ANN))
+      return false;
+    unsigned did = Diags().getCustomDiagID(
+      DiagnosticsEngine::Error,
+      "'" FRESH_ANN "' is reserved for null and newly allocated pointers"
+    );
+    Diags().Report(Loc, did);
+    return true;
+  }
+
+  void VisitCompoundLiteralExpr(CompoundLiteralExpr *E) {
+    spelledFresh(E->getType(), E->getLocStart());
+  }
+  void VisitVAArgExpr(VAArgExpr *E) {
+    spelledFresh(E->getType(), E->getLocStart());
+  }
+  void VisitCXXNewExpr(CXXNewExpr *E) {
+    spelledFresh(E->getAllocatedType(), E->getLocStart());
+  }
+
+  // Is any level of a type (the value itself or anything it points to)
+  // local?
+  bool holdsLocal(QualType T) const {
+    for (;;) {
+      if (local(T))
+        return true;
+      if (T->isPointerType() || T->isReferenceType()) {
+        T = T->getPointeeType();
+      } else if (auto *AT = T->getAsArrayTypeUnsafe()) {
+        T = AT->getElementType();
+      } else {
+        return false;
+      }
+    }
+  }
+
+  // Does a pointer type lead to local data?
+  bool pointsToLocal(QualType T) const {
+    return (T->isPointerType() || T->isReferenceType()) &&
+           holdsLocal(T->getPointeeType());
+  }
+
+  void VisitIntegerLiteral(IntegerLiteral *E) {
+    if (E->getValue() == 0) {
+      AddAnnotation(E, FRESH_ANN);
+    }
+  }
+  void VisitGNUNullExpr(GNUNullExpr *E) {
+    AddAnnotation(E, FRESH_ANN);
+  }
+
+  void VisitCallExpr(CallExpr *E) {
+    Annotator<LocalityAnnotator>::VisitCallExpr(E);
+    FunctionDecl *D = E->getDirectCallee();
+    if (!D)
+      return;
+    unsigned biid = D->getBuiltinID();
+    if (D->hasAttr<RestrictAttr>() || biid == Builtin::BImalloc ||
+        biid == Builtin::BIcalloc) {
+      AddAnnotation(E, FRESH_ANN);
+    }
+  }
+
+  // Locality belongs to whole objects: the members of a local object are
+  // local too.
+  void VisitMemberExpr(MemberExpr *E) {
+    QualType Base = TypeOf(E->getBase());
+    if (E->isArrow())
+      Base = Base->getPointeeType();
+    if (local(Base)) {
+      AddAnnotation(E, LOCAL_ANN);
+    }
+  }
+
+  // Clang types `&obj.field` with the field's declared type, which lost the
+  // object's annotation. Point to the annotated type instead, so the
+  // address cannot escape.
+  void VisitUnaryOperator(UnaryOperator *E) {
+    if (E->getOpcode() != UO_AddrOf)
+      return;
+    QualType Sub = TypeOf(E->getSubExpr());
+    if (local(Sub) && !local(TypeOf(E)->getPointeeType())) {
+      SetTypeOf(E, MakeType([&](ASTContext &Ctx) {
+        return Ctx.getPointerType(Sub);
+      }));
+    }
+  }
+
+  // Explicit casts may neither hide local data behind a shared pointer (or
+  // an integer) nor claim that shared data is local.
+  void VisitExplicitCastExpr(ExplicitCastExpr *E) {
+    if (spelledFresh(E->getTypeAsWritten(), E->getLocStart()))
+      return;
+
+    Expr *Sub = E->getSubExpr();
+    if (fresh(Sub)) {
+      if (!AnnotationOf(E).size())
+        AddAnnotation(E, FRESH_ANN);
+      return;
+    }
+
+    QualType To = TypeOf(E);
+    QualType From = TypeOf(Sub);
+    bool Same;
+    if (To->isPointerType() && From->isPointerType()) {
+      Same = SamePointerTypeAnnotations(To, From, false);
+    } else {
+      Same = !pointsToLocal(To) && !pointsToLocal(From);
+    }
+    if (Same)
+      return;
+
+    unsigned did;
+    if (pointsToLocal(From)) {
+      did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "cast lets local data escape"
+      );
+    } else {
+      did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "cast makes shared data local"
+      );
+    }
+    Diags().Report(E->getLocStart(), did)
+        << CharSourceRange(E->getSourceRange(), false);
+  }
+
+  // Subtyping judgment. Local and shared values may be copied freely; only
+  // the data a pointer leads to must agree, so a pointer to local data can
+  // never become a shared pointer.
+  bool Compatible(QualType LTy, QualType RTy) const {
+    if (fresh(RTy))
+      return true;
+    return CheckPointerInvariance(LTy, RTy);
+  }
+
+  void EmitIncompatibleError(clang::Stmt* S, QualType LTy,
+                             QualType RTy) {
+    unsigned did;
+    if (pointsToLocal(RTy) || (LTy->isReferenceType() && holdsLocal(RTy))) {
+      did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "local data escapes to a shared pointer"
+      );
+    } else {
+      did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "shared data flows into a pointer to local data"
+      );
+    }
+    Diags().Report(S->getLocStart(), did)
+        << CharSourceRange(S->getSourceRange(), false);
+  }
+
+  // Any thread can reach a global, a static, or a field of a shared object,
+  // so those may not hold local data. Thread-local variables are fine.
+  void CheckDecl(ValueDecl *D) {
+    // Parameters are declarations of their own.
+    auto *Func = dyn_cast<FunctionDecl>(D);
+    if (spelledFresh(Func ? Func->getReturnType() : D->getType(),
+                     D->getLocation()))
+      return;
+
+    if (auto *FD = dyn_cast<FieldDecl>(D)) {
+      if (holdsLocal(FD->getType())) {
+        unsigned did = Diags().getCustomDiagID(
+          DiagnosticsEngine::Error,
+          "field %0 cannot hold local data; make the whole object local"
+        );
+        Diags().Report(FD->getLocation(), did) << FD;
+      }
+      return;
+    }
+
+    auto *VD = dyn_cast<VarDecl>(D);
+    if (!VD)
+      return;
+    if (VD->hasGlobalStorage() && VD->getTLSKind() == VarDecl::TLS_None) {
+      if (holdsLocal(VD->getType())) {
+        unsigned did = Diags().getCustomDiagID(
+          DiagnosticsEngine::Error,
+          "%0 is shared by all threads, so it cannot hold local data"
+        );
+        Diags().Report(VD->getLocation(), did) << VD;
+      }
+      return;
+    }
+
+    // Code generation only records top-level annotations, on the allocas
+    // of local variables. Mark the rest with `annotate` attributes, which
+    // reach the IR as llvm.global.annotations and llvm.var.annotation:
+    // thread-local globals that are local, and pointer variables (and
+    // parameters) that point to local data.
+    if (!Instrument)
+      return;
+    QualType T = VD->getType();
+    if (VD->hasGlobalStorage()) {
+      if (local(T))
+        markForCodegen(VD, LOCAL_ATTR);
+    } else if (T->isPointerType() && local(T->getPointeeType())) {
+      markForCodegen(VD, LOCAL_POINTEE_ATTR);
+    }
+  }
+
+  void markForCodegen(VarDecl *VD, StringRef Ann) {
+    for (auto *A : VD->specific_attrs<AnnotateAttr>()) {
+      if (A->getAnnotation() == Ann)
+        return;
+    }
+    VD->addAttr(AnnotateAttr::CreateImplicit(CI.getASTContext(), Ann,
+                                             VD->getLocation()));
+  }
+};
+
+class LocalityAction : public PluginASTAction {
+protected:
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 llvm::StringRef) {
+    // Construct a type checker for our type system.
+    return llvm::make_unique< TAConsumer<LocalityAnnotator> >(CI, true, Opts);
+  }
+
+  bool ParseArgs(const CompilerInstance &CI,
+                 const std::vector<std::string>& args) {
+    return Opts.Parse(CI, args);
+  }
+
+  TAOptions Opts;
+};
+
+}
+
+static FrontendPluginRegistry::Add<LocalityAction>
+X("locality", "thread-local data");
@@ -0,0 +1,60 @@
+// RUN: clang -emit-llvm -S -o - %s | FileCheck %s
+
+#define LOCAL __attribute__((type_annotate("local")))
+
+struct stats {
+  int hits;
+  int misses;
+};
+
+_Thread_local LOCAL int tls_total;
+
+// CHECK-LABEL: define i32 @sum(
+// CHECK-NOT: {{atomicrmw|cmpxchg|load atomic|store atomic}}
+// CHECK: ret i32
+int sum(int *a, int n) {
+  LOCAL int total = 0;
+  for (int i = 0; i < n; ++i)
+    __sync_fetch_and_add(&total, a[i]);
+  return __atomic_load_n(&total, __ATOMIC_SEQ_CST);
+}
+
+// Members of local objects and memory behind pointers to local data.
+// CHECK-LABEL: define void @record(
+// CHECK-NOT: {{atomicrmw|cmpxchg|load atomic|store atomic}}
+// CHECK: ret void
+void record(LOCAL struct stats *st, int hit) {
+  if (hit)
+    __atomic_fetch_add(&st->hits, 1, __ATOMIC_SEQ_CST);
+  else
+    __atomic_fetch_add(&st->misses, 1, __ATOMIC_SEQ_CST);
+}
+
+// CHECK-LABEL: define i32 @claim(
+// CHECK-NOT: {{atomicrmw|cmpxchg|load atomic|store atomic}}
+// CHECK: ret i32
+int claim(void) {
+  LOCAL int owner = 0;
+  int expected = 0;
+  return __atomic_compare_exchange_n(&owner, &expected, 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+// CHECK-LABEL: define void @tls(
+// CHECK-NOT: {{atomicrmw|cmpxchg|load atomic|store atomic}}
+// CHECK: ret void
+void tls(void) {
+  __atomic_store_n(&tls_total, 0, __ATOMIC_RELEASE);
+}
+
+// Shared data keeps its atomics, and fences stay.
+// CHECK-LABEL: define void @publish(
+// CHECK: atomicrmw add
+// CHECK: fence seq_cst
+// CHECK: ret void
+void publish(int *shared) {
+  LOCAL int mine = 0;
+  __sync_fetch_and_add(shared, 1);
+  __atomic_store_n(&mine, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
@@ -0,0 +1,51 @@
+// RUN: clang -fsyntax-only -Xclang -verify %s
+
+#include <stdlib.h>
+
+#define LOCAL __attribute__((type_annotate("local")))
+#define FRESH __attribute__((type_annotate("fresh")))
+
+struct stats {
+  int hits;
+  LOCAL int misses;  // expected-error {{field 'misses' cannot hold local data}}
+};
+
+LOCAL int counter;  // expected-error {{'counter' is shared by all threads}}
+_Thread_local LOCAL int tls_counter;
+int * LOCAL *slot;  // expected-error {{'slot' is shared by all threads}}
+
+void spawn(void (*fn)(void *), void *arg);
+void work(void *arg);
+
+void bump(LOCAL int *p) {
+  *p += 1;
+}
+
+int main() {
+  LOCAL int mine = 0;
+  LOCAL struct stats s;
+  int theirs = mine;  // Copying a local value is fine.
+  LOCAL int *p = &mine;
+  LOCAL int *q = malloc(sizeof(int));
+  LOCAL int *r = NULL;
+  int *shared;
+
+  bump(&mine);
+  bump(&s.hits);
+  bump(&theirs);  // expected-error {{shared data flows into a pointer to local data}}
+  shared = p;  // expected-error {{local data escapes to a shared pointer}}
+  shared = &s.hits;  // expected-error {{local data escapes to a shared pointer}}
+  spawn(work, &mine);  // expected-error {{local data escapes to a shared pointer}}
+
+  shared = (int *)p;  // expected-error {{cast lets local data escape}}
+  long addr = (long)p;  // expected-error {{cast lets local data escape}}
+  q = (LOCAL int *)shared;  // expected-error {{cast makes shared data local}}
+  r = (LOCAL int *)malloc(sizeof(int));
+
+  // Only null and newly allocated pointers are fresh.
+  int * FRESH f = shared;  // expected-error {{'fresh' is reserved}}
+  p = f;
+  p = (int * FRESH)shared;  // expected-error {{'fresh' is reserved}}
+
+  return *p + *q + *r;
+}
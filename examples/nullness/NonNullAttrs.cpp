@@ -0,0 +1,182 @@
+#include "llvm/Pass.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+
+#include "AnnotationInfo.h"
+
+using namespace llvm;
+
+namespace {
+
+cl::opt<bool> NonNull("quala-nonnull",
+    cl::desc("Tell the optimizer that pointers the nullness checker "
+             "considers non-null are never null"),
+    cl::init(false));
+
+// In the nullness type system, every pointer without a `nullable`
+// annotation is non-null. This pass passes that fact on to LLVM:
+//
+// * Pointer parameters get `nonnull` unless they are declared nullable.
+// * Returns get `nonnull` when every returned value is known non-null.
+// * Loads of pointers from local variables get `!nonnull` metadata when
+//   every value stored in the variable is known non-null.
+//
+// This is only sound when the checker's guarantees hold: the code must check
+// without warnings, and every caller must be checked too, since nothing stops
+// unchecked code from passing a null. Hence the opt-in flag. We never add
+// `dereferenceable`: the type system says nothing about how much memory a
+// pointer points to.
+//
+// "Known non-null" only covers values whose source was checked: parameters,
+// results of calls to functions defined (and so checked) in this module, and
+// addresses of variables. Library functions like malloc are unannotated, so
+// the checker takes their results as non-null, but nothing checked them.
+// The same goes for memory in general, which unchecked code may write.
+struct NonNullAttrs : public FunctionPass {
+  static char ID;
+  NonNullAttrs() : FunctionPass(ID) {}
+
+  virtual void getAnalysisUsage(AnalysisUsage &Info) const {
+    Info.addRequired<AnnotationInfo>();
+  }
+
+  virtual bool runOnFunction(Function &F) {
+    AnnotationInfo &AI = getAnalysis<AnnotationInfo>();
+    LLVMContext &Ctx = F.getContext();
+    bool modified = false;
+
+    for (auto &Arg : F.args()) {
+      if (Arg.getType()->isPointerTy() && !Arg.hasNonNullAttr() &&
+          paramNonNull(AI, Arg)) {
+        Arg.addAttr(AttributeSet::get(Ctx, Arg.getArgNo() + 1,
+                                      Attribute::NonNull));
+        modified = true;
+      }
+    }
+
+    bool RetNonNull = F.getReturnType()->isPointerTy();
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        if (auto *LI = dyn_cast<LoadInst>(&I)) {
+          if (LI->getType()->isPointerTy() &&
+              !LI->getMetadata(LLVMContext::MD_nonnull) &&
+              isNonNull(AI, LI)) {
+            LI->setMetadata(LLVMContext::MD_nonnull, MDNode::get(Ctx, None));
+            modified = true;
+          }
+        } else if (auto *RI = dyn_cast<ReturnInst>(&I)) {
+          if (RetNonNull && !isNonNull(AI, RI->getReturnValue()))
+            RetNonNull = false;
+        }
+      }
+    }
+    if (RetNonNull &&
+        !F.getAttributes().hasAttribute(AttributeSet::ReturnIndex,
+                                        Attribute::NonNull)) {
+      F.addAttribute(AttributeSet::ReturnIndex, Attribute::NonNull);
+      modified = true;
+    }
+
+    return modified;
+  }
+
+  // Clang spills each parameter to a `.addr` alloca on entry, and the
+  // alloca carries the parameter's annotation one level down.
+  bool paramNonNull(AnnotationInfo &AI, Argument &Arg) {
+    for (auto *U : Arg.users()) {
+      auto *SI = dyn_cast<StoreInst>(U);
+      if (SI && SI->getValueOperand() == &Arg &&
+          isa<AllocaInst>(SI->getPointerOperand())) {
+        return !AI.hasAnnotation(SI->getPointerOperand(), "nullable", 1);
+      }
+    }
+    // No spill (e.g., already optimized): we can't see the declared type.
+    return false;
+  }
+
+  // Is a value non-null according to the checker? Results of calls to
+  // functions defined elsewhere are not trusted: their bodies may never
+  // have been checked. Merged values are checked operand by operand, since
+  // the checker gives a conditional expression no annotation of its own.
+  bool isNonNull(AnnotationInfo &AI, Value *V) {
+    SmallPtrSet<Value*, 8> Visited;
+    return isNonNull(AI, V, Visited);
+  }
+
+  bool isNonNull(AnnotationInfo &AI, Value *V,
+                 SmallPtrSetImpl<Value*> &Visited) {
+    V = V->stripPointerCasts();
+    if (!Visited.insert(V).second)
+      return true;  // A cycle adds no new values.
+
+    if (auto *GV = dyn_cast<GlobalValue>(V))
+      return !GV->hasExternalWeakLinkage();
+    if (isa<Constant>(V))
+      return !V->isNullValue() && !isa<UndefValue>(V);
+    if (AI.hasAnnotation(V, "nullable"))
+      return false;
+    if (auto *Arg = dyn_cast<Argument>(V))
+      return Arg->hasNonNullAttr();
+    if (auto CS = CallSite(V)) {
+      Function *Callee = CS.getCalledFunction();
+      return Callee && !Callee->isDeclaration();
+    }
+    if (auto *PN = dyn_cast<PHINode>(V)) {
+      for (Value *In : PN->incoming_values()) {
+        if (!isNonNull(AI, In, Visited))
+          return false;
+      }
+      return true;
+    }
+    if (auto *Sel = dyn_cast<SelectInst>(V)) {
+      return isNonNull(AI, Sel->getTrueValue(), Visited) &&
+             isNonNull(AI, Sel->getFalseValue(), Visited);
+    }
+    if (auto *GEP = dyn_cast<GEPOperator>(V))
+      return isNonNull(AI, GEP->getPointerOperand(), Visited);
+    if (auto *LI = dyn_cast<LoadInst>(V))
+      return storedNonNull(AI, LI, Visited);
+    return isa<AllocaInst>(V);
+  }
+
+  // This runs before mem2reg, so every use of a variable is a load from its
+  // alloca. The load is as non-null as everything stored there, as long as
+  // the variable's address does not escape.
+  bool storedNonNull(AnnotationInfo &AI, LoadInst *LI,
+                     SmallPtrSetImpl<Value*> &Visited) {
+    auto *Slot = dyn_cast<AllocaInst>(LI->getPointerOperand());
+    if (!Slot || LI->isVolatile())
+      return false;
+    for (auto *U : Slot->users()) {
+      if (isa<LoadInst>(U))
+        continue;
+      auto *SI = dyn_cast<StoreInst>(U);
+      if (!SI || SI->getValueOperand() == Slot ||
+          !isNonNull(AI, SI->getValueOperand(), Visited))
+        return false;
+    }
+    return true;
+  }
+};
+
+}
+
+char NonNullAttrs::ID = 0;
+
+static void registerPass(const PassManagerBuilder &,
+                         legacy::PassManagerBase &PM) {
+  if (NonNull)
+    PM.add(new NonNullAttrs());
+}
+static RegisterStandardPasses
+  RegisterMyPass(PassManagerBuilder::EP_EarlyAsPossible,
+                 registerPass);
@@ -1,31 +1,166 @@
 #include "llvm/Pass.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/InlineAsm.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/IR/LegacyPassManager.h"
 
 #include "AnnotationInfo.h"
 
+#define DEBUG_TYPE "quala-null-checks"
+
 using namespace llvm;
 
+STATISTIC(NumSites, "Number of nullable dereferences");
+STATISTIC(NumMerged, "Number of null checks merged into a dominating check");
+STATISTIC(NumHoisted, "Number of null checks hoisted out of loops");
+STATISTIC(NumDropped, "Number of null checks dropped by partial checking");
+STATISTIC(NumUnchecked, "Number of accesses checked because the type "
+                        "checker gave up on their function");
+
 namespace {
 
+// How a failed check is handled.
+enum NullCheckMode {
+  NCM_Call,     // Call qualaNullCheck, which calls qualaHandleNull or exit(3).
+  NCM_Trap,     // Branch to an inline llvm.trap. No runtime needed.
+  NCM_Runtime,  // Report a site ID to the minimal runtime (NullRuntime.c).
+};
+
+cl::opt<NullCheckMode> CheckMode("quala-null-mode",
+    cl::desc("How failed null checks are handled"),
+    cl::values(
+      clEnumValN(NCM_Call, "call", "call qualaNullCheck (default)"),
+      clEnumValN(NCM_Trap, "trap", "trap inline with llvm.trap"),
+      clEnumValN(NCM_Runtime, "runtime",
+                 "report the site ID to the quala null runtime"),
+      clEnumValEnd),
+    cl::init(NCM_Call));
+
+cl::opt<bool> CheckRecover("quala-null-recover",
+    cl::desc("Continue after reporting a null dereference (runtime mode)"),
+    cl::init(false));
+
+cl::opt<bool> CheckGuard("quala-null-guard",
+    cl::desc("Guard each function's null checks with a flag that can be "
+             "toggled at run time"),
+    cl::init(false));
+
+cl::opt<bool> CheckGuardDefault("quala-null-guard-default",
+    cl::desc("Initial state of the run-time guard flags"),
+    cl::init(false));
+
+cl::opt<bool> CheckPlacement("quala-null-pgo",
+    cl::desc("Place null checks by block frequency (from profile data when "
+             "available): merge redundant checks and hoist invariant ones "
+             "out of loops"),
+    cl::init(false));
+
+cl::opt<unsigned> CheckPartial("quala-null-partial",
+    cl::desc("Partial checking: leave the hottest N% of each function's "
+             "null check sites unchecked"),
+    cl::value_desc("N"),
+    cl::init(0));
+
+// The checker marks functions it gave up on (see TAVisitor::fallBack).
+const char *const UncheckedAttr = "quala-unchecked";
+
+// The string an llvm.global.annotations entry refers to.
+StringRef annotationString(Value *V) {
+  auto *GV = dyn_cast<GlobalVariable>(V->stripPointerCasts());
+  if (!GV || !GV->hasInitializer())
+    return StringRef();
+  auto *Str = dyn_cast<ConstantDataArray>(GV->getInitializer());
+  if (!Str || !Str->isCString())
+    return StringRef();
+  return Str->getAsCString();
+}
+
+// A nullable dereference and where its check goes.
+struct Site {
+  Instruction *Access;
+  Value *Ptr;        // The pointer to test.
+  Instruction *At;   // The check goes just before this instruction.
+  Value *Key;        // Checks with the same key test the same value.
+  uint64_t Freq;     // Block frequency of the access.
+};
+
 struct NullChecks : public FunctionPass {
   static char ID;
   NullChecks() : FunctionPass(ID) {}
 
+  // Site table entries (runtime mode) and guard table entries (guard mode)
+  // collected over the whole module.
+  std::vector<Constant*> Sites;
+  std::vector<Constant*> Guards;
+
+  // Functions the type checker did not finish checking. Any pointer in
+  // them may be null, so every access through memory that is not on the
+  // stack or global gets a check.
+  SmallPtrSet<const Function*, 8> Unchecked;
+
   virtual void getAnalysisUsage(AnalysisUsage &Info) const {
     Info.addRequired<AnnotationInfo>();
+    if (CheckPlacement || CheckPartial) {
+      Info.addRequired<BlockFrequencyInfo>();
+      Info.addRequired<DominatorTreeWrapperPass>();
+      Info.addRequired<PostDominatorTree>();
+      Info.addRequired<LoopInfoWrapperPass>();
+    }
+  }
+
+  virtual bool doInitialization(Module &M) {
+    Unchecked.clear();
+    GlobalVariable *Anns = M.getNamedGlobal("llvm.global.annotations");
+    if (!Anns || !Anns->hasInitializer())
+      return false;
+    auto *Entries = dyn_cast<ConstantArray>(Anns->getInitializer());
+    if (!Entries)
+      return false;
+    for (auto &Op : Entries->operands()) {
+      auto *Entry = dyn_cast<ConstantStruct>(Op);
+      if (Entry && Entry->getNumOperands() >= 2 &&
+          annotationString(Entry->getOperand(1)) == UncheckedAttr) {
+        if (auto *F = dyn_cast<Function>(
+              Entry->getOperand(0)->stripPointerCasts()))
+          Unchecked.insert(F);
+      }
+    }
+    return false;
   }
 
   virtual bool runOnFunction(Function &F) {
     AnnotationInfo &AI = getAnalysis<AnnotationInfo>();
-    bool modified = false;
+    const DataLayout &DL = F.getParent()->getDataLayout();
+    bool CheckAll = Unchecked.count(&F);
 
+    // Find the dereferences first: inserting checks in the inline modes
+    // splits blocks, which would invalidate the iteration.
+    std::vector<Site> Checks;
     for (auto &BB : F) {
       for (auto &I : BB) {
         // Is this a load or store? Get the address.
@@ -37,19 +172,258 @@ struct NullChecks : public FunctionPass {
         }
 
         // Dereferencing a pointer (either for a load or a store). Insert a
-        // check if the pointer is nullable.
-        if (Ptr) {
+        // check if the pointer is nullable. In an unchecked function, check
+        // the base of every address (`p` for `p->f`) instead.
+        if (Ptr && CheckAll) {
+          Value *Base = GetUnderlyingObject(Ptr, DL);
+          if (!isa<AllocaInst>(Base) && !isa<GlobalValue>(Base)) {
+            Site S = { &I, Base, &I, Base, 0 };
+            Checks.push_back(S);
+            ++NumUnchecked;
+          }
+        } else if (Ptr) {
           if (AI.hasAnnotation(Ptr, "nullable")) {
-            addCheck(*Ptr, I);
-            modified = true;
+            Site S = { &I, Ptr, &I, Ptr, 0 };
+            Checks.push_back(S);
           }
         }
       }
     }
 
+    if (Checks.empty())
+      return false;
+    NumSites += Checks.size();
+
+    if (CheckPlacement || CheckPartial)
+      placeChecks(F, Checks);
+
+    Value *Enabled = nullptr;
+    if (CheckGuard)
+      Enabled = addGuard(F);
+
+    unsigned TrapSite = 0;
+    for (auto &C : Checks) {
+      switch (CheckMode) {
+      case NCM_Call:
+        addCheck(*C.Ptr, *C.At, Enabled);
+        break;
+      case NCM_Trap:
+        addTrapCheck(*C.Ptr, *C.At, *C.Access, Enabled, TrapSite++);
+        break;
+      case NCM_Runtime:
+        addRuntimeCheck(*C.Ptr, *C.At, *C.Access, Enabled);
+        break;
+      }
+    }
+
+    return true;
+  }
+
+  // Profile-guided placement. Block frequencies come from `!prof` branch
+  // weights when Clang had profile data, and from static estimates
+  // otherwise. In order:
+  //
+  // * A check of a loop-invariant pointer moves to the loop's preheader
+  //   when that is colder and the access runs whenever the preheader does
+  //   (it post-dominates the preheader). Loops with calls are left alone,
+  //   so a failure cannot move ahead of any output.
+  // * With -quala-null-partial=N, the hottest N% of the checks are dropped.
+  // * A check dominated by another check of the same value is dropped: the
+  //   value has already been found non-null.
+  //
+  // The trade-off is reported as an optimization remark
+  // (-Rpass-analysis=quala-null-checks).
+  void placeChecks(Function &F, std::vector<Site> &Checks) {
+    auto &BFI = getAnalysis<BlockFrequencyInfo>();
+    auto &DT = getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+    auto &PDT = getAnalysis<PostDominatorTree>();
+    auto &LI = getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+    auto freq = [&](Instruction *I) {
+      return BFI.getBlockFreq(I->getParent()).getFrequency();
+    };
+
+    DebugLoc Loc = Checks.front().Access->getDebugLoc();
+    uint64_t Before = 0;
+    for (auto &C : Checks) {
+      C.Key = storedValue(C.Ptr, DT);
+      C.Freq = freq(C.Access);
+      Before += C.Freq;
+    }
+
+    unsigned Hoisted = 0;
+    if (CheckPlacement) {
+      for (auto &C : Checks) {
+        for (Loop *L = LI.getLoopFor(C.At->getParent()); L;
+             L = L->getParentLoop()) {
+          BasicBlock *PH = L->getLoopPreheader();
+          if (!PH || !L->isLoopInvariant(C.Key) ||
+              !PDT.dominates(C.At->getParent(), PH) ||
+              freq(PH->getTerminator()) >= freq(C.At) || hasCalls(L))
+            break;
+          C.At = PH->getTerminator();
+          C.Ptr = C.Key;
+        }
+        if (C.At != C.Access)
+          ++Hoisted;
+      }
+    }
+
+    // Drop the hottest sites first, so that a dropped check does not leave
+    // the checks merged into it unchecked.
+    std::vector<Site> Dropped;
+    if (CheckPartial) {
+      std::stable_sort(Checks.begin(), Checks.end(),
+                       [&](const Site &A, const Site &B) {
+        return freq(A.At) > freq(B.At);
+      });
+      size_t N = Checks.size() * std::min(100u, (unsigned)CheckPartial) / 100;
+      Dropped.assign(Checks.begin(), Checks.begin() + N);
+      Checks.erase(Checks.begin(), Checks.begin() + N);
+    }
+
+    unsigned Merged = 0;
+    if (CheckPlacement) {
+      std::vector<Site> Kept;
+      for (size_t i = 0; i < Checks.size(); ++i) {
+        bool Redundant = false;
+        for (size_t j = 0; j < Checks.size() && !Redundant; ++j) {
+          if (i == j || Checks[i].Key != Checks[j].Key)
+            continue;
+          if (Checks[i].At == Checks[j].At)
+            Redundant = j < i;
+          else
+            Redundant = DT.dominates(Checks[j].At, Checks[i].At);
+        }
+        if (Redundant)
+          ++Merged;
+        else
+          Kept.push_back(Checks[i]);
+      }
+      Checks.swap(Kept);
+    }
+
+    uint64_t After = 0, Unchecked = 0;
+    for (auto &C : Checks)
+      After += freq(C.At);
+    for (auto &C : Dropped)
+      Unchecked += C.Freq;
+    NumHoisted += Hoisted;
+    NumMerged += Merged;
+    NumDropped += Dropped.size();
+
+    // Frequencies are relative to the entry block, i.e., per call.
+    LLVMContext &Ctx = F.getContext();
+    double Entry = BFI.getEntryFreq();
+    for (auto &C : Dropped) {
+      std::string Msg;
+      raw_string_ostream OS(Msg);
+      OS << "null check left out by partial checking (about "
+         << format("%.1f", C.Freq / Entry) << " executions per call)";
+      emitOptimizationRemarkAnalysis(Ctx, DEBUG_TYPE, F,
+                                     C.Access->getDebugLoc(), OS.str());
+    }
+    std::string Msg;
+    raw_string_ostream OS(Msg);
+    OS << "null checks in " << F.getName() << ": "
+       << (Checks.size() + Merged + Dropped.size()) << " sites, "
+       << Merged << " merged, " << Hoisted << " hoisted, "
+       << Dropped.size() << " dropped; about "
+       << format("%.1f", After / Entry) << " checks per call (was "
+       << format("%.1f", Before / Entry) << "), "
+       << format("%.1f", Unchecked / Entry) << " unchecked accesses per call";
+    emitOptimizationRemarkAnalysis(Ctx, DEBUG_TYPE, F, Loc, OS.str());
+  }
+
+  // The value a pointer is known to equal. This runs before mem2reg, so
+  // each use of a variable loads it again; a variable that is stored only
+  // once, like a parameter's slot, holds the stored value wherever that
+  // store dominates.
+  Value *storedValue(Value *Ptr, DominatorTree &DT) {
+    auto *Load = dyn_cast<LoadInst>(Ptr);
+    if (!Load || Load->isVolatile())
+      return Ptr;
+    auto *Slot = dyn_cast<AllocaInst>(Load->getPointerOperand());
+    if (!Slot)
+      return Ptr;
+
+    StoreInst *Only = nullptr;
+    for (User *U : Slot->users()) {
+      if (auto *L = dyn_cast<LoadInst>(U)) {
+        if (L->isVolatile())
+          return Ptr;
+      } else if (auto *S = dyn_cast<StoreInst>(U)) {
+        if (Only || S->isVolatile() || S->getValueOperand() == Slot)
+          return Ptr;
+        Only = S;
+      } else {
+        return Ptr;  // The variable's address escapes.
+      }
+    }
+    if (Only && DT.dominates(Only, Load))
+      return Only->getValueOperand();
+    return Ptr;
+  }
+
+  // Does a loop call anything (other than an intrinsic) that might have a
+  // visible effect?
+  bool hasCalls(Loop *L) {
+    for (BasicBlock *BB : L->getBlocks()) {
+      for (auto &I : *BB) {
+        CallSite CS(&I);
+        if (CS && !isa<IntrinsicInst>(I) &&
+            (I.mayWriteToMemory() || I.mayThrow()))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  // Emit the site table for the runtime mode and the guard table for the
+  // guard mode.
+  virtual bool doFinalization(Module &M) {
+    bool modified = false;
+    if (!Sites.empty()) {
+      addTable(M, getSiteType(M.getContext()), Sites, "quala.null.sites",
+               getSection(M, "quala_null_sites", "__quala_null"));
+      modified = true;
+    }
+    if (!Guards.empty()) {
+      addTable(M, getGuardType(M.getContext()), Guards, "quala.null.guards",
+               getSection(M, "quala_null_guards", "__quala_guard"));
+      addRuntimeRef(M);
+      modified = true;
+    }
+
+    Sites.clear();
+    SiteIDs.clear();
+    Guards.clear();
+    Strings.clear();
     return modified;
   }
 
+  void addTable(Module &M, StructType *EntryTy, ArrayRef<Constant*> Entries,
+                StringRef Name, StringRef Section) {
+    auto *Ty = ArrayType::get(EntryTy, Entries.size());
+    auto *Table = new GlobalVariable(M, Ty, true,
+        GlobalValue::PrivateLinkage, ConstantArray::get(Ty, Entries), Name);
+    Table->setSection(Section);
+    Table->setAlignment(8);
+    addToUsed(M, Table);
+  }
+
+  // Only the runtime can turn guards on, but in the call and trap modes
+  // nothing else refers to it, so the linker would leave it out of the
+  // program when it comes from libqualanull.a. A reference that is kept
+  // alive with llvm.used pulls it in.
+  void addRuntimeRef(Module &M) {
+    LLVMContext &Ctx = M.getContext();
+    Constant *Runtime = M.getOrInsertGlobal("__quala_null_runtime",
+                                            Type::getInt8Ty(Ctx));
+    auto *Ref = new GlobalVariable(M, Runtime->getType(), true,
+        GlobalValue::PrivateLinkage, Runtime, "quala.null.runtime.ref");
+    addToUsed(M, Ref);
+  }
+
   Function &getCheckFunc(Module &M) {
     LLVMContext &Ctx = M.getContext();
 
@@ -96,13 +470,208 @@ struct NullChecks : public FunctionPass {
   }
 
   // Insert a null check for the given pointer value just before the
-  // instruction.
-  void addCheck(Value &Ptr, Instruction &I) {
+  // instruction. With a guard, the check (and its call) is skipped entirely
+  // while the guard is off.
+  void addCheck(Value &Ptr, Instruction &I, Value *Enabled) {
     IRBuilder<> Bld(&I);
+    if (Enabled) {
+      Bld.SetInsertPoint(SplitBlockAndInsertIfThen(Enabled, &I, false));
+    }
     Value *isnull = Bld.CreateIsNull(&Ptr, "isnull");
     Module *M = I.getParent()->getParent()->getParent();
     Bld.CreateCall(&(getCheckFunc(*M)), isnull);
   }
+
+  // Null is never expected: weight the branches so the failure path is laid
+  // out cold.
+  MDNode *getUnlikelyWeights(LLVMContext &Ctx) {
+    return MDBuilder(Ctx).createBranchWeights(1, (1U << 20) - 1);
+  }
+
+  // Insert an inline check that branches to a trap. Each site gets its own
+  // trap, at the access's debug location, so the trapping PC identifies the
+  // site (through a debugger or addr2line). Identical trap blocks would be
+  // merged by SimplifyCFG and branch folding, so each starts with an empty
+  // inline asm marker that carries the site's number in the function.
+  void addTrapCheck(Value &Ptr, Instruction &I, Instruction &Access,
+                    Value *Enabled, unsigned TrapSite) {
+    BasicBlock *BB = I.getParent();
+    Function *F = BB->getParent();
+    LLVMContext &Ctx = F->getContext();
+
+    BasicBlock *TrapBB = BasicBlock::Create(Ctx, "quala.trap", F);
+    {
+      IRBuilder<> Bld(TrapBB);
+      Bld.SetCurrentDebugLocation(Access.getDebugLoc());
+      Type *Int32Ty = Type::getInt32Ty(Ctx);
+      auto *MarkerTy = FunctionType::get(Type::getVoidTy(Ctx), Int32Ty, false);
+      Bld.CreateCall(InlineAsm::get(MarkerTy, "", "i", true),
+                     Bld.getInt32(TrapSite));
+      Bld.CreateCall(Intrinsic::getDeclaration(F->getParent(),
+                                               Intrinsic::trap));
+      Bld.CreateUnreachable();
+    }
+
+    IRBuilder<> Bld(&I);
+    Value *isnull = guardCond(Bld, Bld.CreateIsNull(&Ptr, "isnull"), Enabled);
+    BasicBlock *Cont = BB->splitBasicBlock(&I, "quala.cont");
+    BB->getTerminator()->eraseFromParent();
+    BranchInst::Create(TrapBB, Cont, isnull, BB)
+        ->setMetadata(LLVMContext::MD_prof, getUnlikelyWeights(Ctx));
+  }
+
+  // Insert an inline check that passes a compact site ID to the runtime on
+  // failure. The ID is mapped back to a source location (that of the
+  // access, which may be elsewhere when the check was hoisted) through the
+  // site table emitted in doFinalization.
+  void addRuntimeCheck(Value &Ptr, Instruction &I, Instruction &Access,
+                       Value *Enabled) {
+    Module *M = I.getParent()->getParent()->getParent();
+    LLVMContext &Ctx = M->getContext();
+
+    IRBuilder<> Bld(&I);
+    Value *isnull = guardCond(Bld, Bld.CreateIsNull(&Ptr, "isnull"), Enabled);
+    TerminatorInst *Fail = SplitBlockAndInsertIfThen(isnull, &I,
+        !CheckRecover, getUnlikelyWeights(Ctx));
+    Bld.SetInsertPoint(Fail);
+    Bld.CreateCall(getReportFunc(*M), Bld.getInt32(addSite(*M, Access)));
+  }
+
+  Constant *getReportFunc(Module &M) {
+    LLVMContext &Ctx = M.getContext();
+    AttributeSet Attrs;
+    if (!CheckRecover) {
+      Attrs = Attrs.addAttribute(Ctx, AttributeSet::FunctionIndex,
+          Attribute::NoReturn);
+    }
+    Attrs = Attrs.addAttribute(Ctx, AttributeSet::FunctionIndex,
+        Attribute::Cold);
+    return M.getOrInsertFunction(
+        CheckRecover ? "__quala_null_report" : "__quala_null_report_abort",
+        Attrs, Type::getVoidTy(Ctx), Type::getInt32Ty(Ctx), NULL);
+  }
+
+  // In the inline modes, a guard just masks the failure condition.
+  Value *guardCond(IRBuilder<> &Bld, Value *isnull, Value *Enabled) {
+    if (!Enabled)
+      return isnull;
+    return Bld.CreateAnd(Enabled, isnull, "isnull.guarded");
+  }
+
+  // Give the function a run-time flag that turns its checks on and off, and
+  // register it in the guard table so the runtime can find it by module and
+  // function name. The flag is read once on entry, so disabled checks cost a
+  // load per call and a predictable branch (or an "and") per site.
+  Value *addGuard(Function &F) {
+    Module &M = *F.getParent();
+    LLVMContext &Ctx = M.getContext();
+    Type *Int8Ty = Type::getInt8Ty(Ctx);
+
+    auto *Flag = new GlobalVariable(M, Int8Ty, false,
+        GlobalValue::PrivateLinkage,
+        ConstantInt::get(Int8Ty, CheckGuardDefault ? 1 : 0),
+        "quala.null.enabled");
+    Constant *Fields[] = {
+      Flag,
+      getString(M, F.getName()),
+      getString(M, M.getModuleIdentifier()),
+    };
+    Guards.push_back(ConstantStruct::get(getGuardType(Ctx), Fields));
+
+    IRBuilder<> Bld(&*F.getEntryBlock().getFirstInsertionPt());
+    return Bld.CreateIsNotNull(Bld.CreateLoad(Flag), "quala.enabled");
+  }
+
+  // Table sections. On ELF, a C-identifier section name makes the linker
+  // define __start_ and __stop_ symbols for it, which is how the runtime
+  // finds the tables.
+  std::string getSection(Module &M, StringRef ELFName, StringRef MachOName) {
+    if (Triple(M.getTargetTriple()).isOSBinFormatMachO())
+      return ("__DATA," + MachOName).str();
+    return ELFName;
+  }
+
+  // Layout of a guard table entry; must match QualaNullGuard in
+  // NullRuntime.c.
+  StructType *getGuardType(LLVMContext &Ctx) {
+    Type *Int8PtrTy = Type::getInt8PtrTy(Ctx);
+    return StructType::get(Int8PtrTy, Int8PtrTy, Int8PtrTy, NULL);
+  }
+
+  // Layout of a site table entry; must match QualaNullSite in NullRuntime.c.
+  StructType *getSiteType(LLVMContext &Ctx) {
+    Type *Int32Ty = Type::getInt32Ty(Ctx);
+    return StructType::get(Int32Ty, Int32Ty, Int32Ty,
+                           Type::getInt8PtrTy(Ctx), NULL);
+  }
+
+  // Record a table entry for the instruction and return its site ID. IDs mix
+  // the module name with a per-module index so that sites from different
+  // objects rarely collide in a linked program. Within the module, a
+  // collision moves on to the next free ID; the runtime reports the
+  // (unlikely) collisions between modules.
+  uint32_t addSite(Module &M, Instruction &I) {
+    LLVMContext &Ctx = M.getContext();
+    uint32_t SiteID = (uint32_t)hash_combine(M.getModuleIdentifier(),
+                                             Sites.size());
+    while (!SiteIDs.insert(SiteID).second)
+      ++SiteID;
+
+    unsigned Line = 0, Col = 0;
+    StringRef File = M.getModuleIdentifier();
+    if (DILocation *Loc = I.getDebugLoc()) {
+      Line = Loc->getLine();
+      Col = Loc->getColumn();
+      File = Loc->getFilename();
+    }
+
+    IRBuilder<> Bld(Ctx);
+    Constant *Fields[] = {
+      Bld.getInt32(SiteID),
+      Bld.getInt32(Line),
+      Bld.getInt32(Col),
+      getString(M, File),
+    };
+    Sites.push_back(ConstantStruct::get(getSiteType(Ctx), Fields));
+    return SiteID;
+  }
+
+  // Get a private, uniqued C string for the site or guard table.
+  Constant *getString(Module &M, StringRef S) {
+    Constant *&Str = Strings[S];
+    if (!Str) {
+      Constant *Init = ConstantDataArray::getString(M.getContext(), S);
+      auto *GV = new GlobalVariable(M, Init->getType(), true,
+          GlobalValue::PrivateLinkage, Init, "quala.null.str");
+      GV->setUnnamedAddr(true);
+      Str = ConstantExpr::getPointerCast(GV,
+          Type::getInt8PtrTy(M.getContext()));
+    }
+    return Str;
+  }
+  StringMap<Constant*> Strings;
+  DenseSet<uint32_t> SiteIDs;
+
+  // Keep a global alive through optimization and linking by adding it to
+  // llvm.used. Nothing in the code refers to the site table directly.
+  void addToUsed(Module &M, GlobalValue *GV) {
+    Type *Int8PtrTy = Type::getInt8PtrTy(M.getContext());
+    std::vector<Constant*> Used;
+    if (GlobalVariable *Old = M.getGlobalVariable("llvm.used")) {
+      if (auto *Init = dyn_cast<ConstantArray>(Old->getInitializer())) {
+        for (auto &Op : Init->operands())
+          Used.push_back(cast<Constant>(Op));
+      }
+      Old->eraseFromParent();
+    }
+    Used.push_back(ConstantExpr::getPointerCast(GV, Int8PtrTy));
+
+    auto *Ty = ArrayType::get(Int8PtrTy, Used.size());
+    auto *GVUsed = new GlobalVariable(M, Ty, false,
+        GlobalValue::AppendingLinkage, ConstantArray::get(Ty, Used),
+        "llvm.used");
+    GVUsed->setSection("llvm.metadata");
+  }
 };
 
 }
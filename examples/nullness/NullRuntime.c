@@ -0,0 +1,195 @@
+// Minimal runtime for NullChecks in -quala-null-mode=runtime. Each check
+// site passes a 32-bit site ID on failure; the pass also emits a table
+// mapping IDs to source locations in a dedicated section, which we search
+// here to produce a useful message.
+//
+// The runtime also owns the flags behind -quala-null-guard. See
+// NullRuntime.h for the API.
+
+#include "NullRuntime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Must match NullChecks::getSiteType.
+struct QualaNullSite {
+  uint32_t id;
+  uint32_t line;
+  uint32_t column;
+  const char *file;
+};
+
+// Must match NullChecks::getGuardType.
+struct QualaNullGuard {
+  uint8_t *enabled;
+  const char *function;
+  const char *module;
+};
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#include <mach-o/getsect.h>
+
+// Call f on each table entry in the named section of every loaded image
+// until it returns nonzero. Returns that entry, or NULL.
+static const void *forEachEntry(const char *sect, size_t entrySize,
+                                int (*f)(const void *, const void *),
+                                const void *arg) {
+  for (uint32_t i = 0; i < _dyld_image_count(); ++i) {
+    unsigned long size = 0;
+    const char *data = (const char *)getsectiondata(
+        (const void *)_dyld_get_image_header(i), "__DATA", sect, &size);
+    for (unsigned long j = 0; j + entrySize <= size; j += entrySize) {
+      if (f(data + j, arg))
+        return data + j;
+    }
+  }
+  return NULL;
+}
+
+#define FOR_EACH_ENTRY(elfname, machoname, type, f, arg) \
+  forEachEntry(machoname, sizeof(type), f, arg)
+
+#else
+// The linker defines these around each section. Weak so that a program
+// without any sites or guards still links.
+extern const struct QualaNullSite __start_quala_null_sites[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct QualaNullSite __stop_quala_null_sites[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct QualaNullGuard __start_quala_null_guards[]
+    __attribute__((weak, visibility("hidden")));
+extern const struct QualaNullGuard __stop_quala_null_guards[]
+    __attribute__((weak, visibility("hidden")));
+
+static const void *forEachEntry(const char *begin, const char *end,
+                                size_t entrySize,
+                                int (*f)(const void *, const void *),
+                                const void *arg) {
+  for (; begin && begin + entrySize <= end; begin += entrySize) {
+    if (f(begin, arg))
+      return begin;
+  }
+  return NULL;
+}
+
+#define FOR_EACH_ENTRY(elfname, machoname, type, f, arg) \
+  forEachEntry((const char *)__start_##elfname, \
+               (const char *)__stop_##elfname, sizeof(type), f, arg)
+#endif
+
+// IDs are unique within an object, but two objects in one program can
+// (rarely) share one. Then we cannot tell the sites apart, so we list them
+// all.
+struct SiteQuery {
+  uint32_t id;
+  unsigned count;
+  int print;
+};
+
+static int siteMatches(const void *entry, const void *arg) {
+  const struct QualaNullSite *site = (const struct QualaNullSite *)entry;
+  struct SiteQuery *query = (struct SiteQuery *)arg;
+  if (site->id == query->id) {
+    ++query->count;
+    if (query->print) {
+      fprintf(stderr, "%s:%u:%u: quala: null dereference\n",
+              site->file, site->line, site->column);
+    }
+  }
+  return 0;
+}
+
+// Report each site only once in recovering mode, like UBSan's minimal
+// runtime. Past this many sites we just keep reporting. The table is a
+// lock-free hash set, since checks fail on any thread: a slot holds an ID
+// plus a "used" bit, and is claimed with a compare-and-swap.
+#define MAX_REPORTED 256
+static uint64_t reported[MAX_REPORTED];
+
+static int alreadyReported(uint32_t id) {
+  uint64_t key = (uint64_t)id | ((uint64_t)1 << 32);
+  for (unsigned i = 0; i < MAX_REPORTED; ++i) {
+    uint64_t *slot = &reported[(id + i) % MAX_REPORTED];
+    uint64_t seen = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (seen == 0 &&
+        __atomic_compare_exchange_n(slot, &seen, key, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_ACQUIRE))
+      return 0;
+    // Either the slot was taken already, or another thread just took it.
+    if (seen == key)
+      return 1;
+  }
+  return 0;
+}
+
+static void report(uint32_t id) {
+  struct SiteQuery query = { id, 0, 0 };
+  FOR_EACH_ENTRY(quala_null_sites, "__quala_null", struct QualaNullSite,
+                 siteMatches, &query);
+  if (query.count == 0) {
+    fprintf(stderr, "quala: null dereference at unknown site 0x%08x\n", id);
+    return;
+  }
+  if (query.count > 1) {
+    fprintf(stderr, "quala: null dereference at one of %u sites sharing ID "
+            "0x%08x:\n", query.count, id);
+  }
+  query.print = 1;
+  FOR_EACH_ENTRY(quala_null_sites, "__quala_null", struct QualaNullSite,
+                 siteMatches, &query);
+}
+
+void __quala_null_report(uint32_t id) {
+  if (!alreadyReported(id))
+    report(id);
+}
+
+void __quala_null_report_abort(uint32_t id) {
+  report(id);
+  abort();
+}
+
+// Guard control. A NULL pattern matches anything; otherwise names must match
+// exactly. The module name is the one the compiler saw (usually the path of
+// the source file).
+struct GuardQuery {
+  const char *module;
+  const char *function;
+  int enabled;
+  unsigned count;
+};
+
+static int setGuard(const void *entry, const void *arg) {
+  const struct QualaNullGuard *guard = (const struct QualaNullGuard *)entry;
+  struct GuardQuery *query = (struct GuardQuery *)arg;
+  if ((!query->module || strcmp(query->module, guard->module) == 0) &&
+      (!query->function || strcmp(query->function, guard->function) == 0)) {
+    *guard->enabled = query->enabled ? 1 : 0;
+    ++query->count;
+  }
+  return 0;
+}
+
+unsigned quala_null_checks_set(const char *module, const char *function,
+                               int enabled) {
+  struct GuardQuery query = { module, function, enabled, 0 };
+  FOR_EACH_ENTRY(quala_null_guards, "__quala_guard", struct QualaNullGuard,
+                 setGuard, &query);
+  return query.count;
+}
+
+// Code compiled with -quala-null-guard refers to this, so linking against
+// libqualanull.a always brings in initGuards below.
+const char __quala_null_runtime = 0;
+
+// Let deployments turn guarded checks on without code changes: set
+// QUALA_NULL_CHECKS to 1 to enable every guarded check at startup, or to 0 to
+// disable them all.
+__attribute__((constructor))
+static void initGuards(void) {
+  const char *env = getenv("QUALA_NULL_CHECKS");
+  if (env && *env)
+    quala_null_checks_set(NULL, NULL, strcmp(env, "0") != 0);
+}
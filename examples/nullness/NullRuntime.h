@@ -0,0 +1,26 @@
+#ifndef QUALA_NULL_RUNTIME_H
+#define QUALA_NULL_RUNTIME_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Failure entry points called by code instrumented in
+// -quala-null-mode=runtime. The recovering variant reports each site once.
+void __quala_null_report(uint32_t id);
+void __quala_null_report_abort(uint32_t id);
+
+// Turn the checks in code compiled with -quala-null-guard on or off. A NULL
+// module or function name matches anything; function names are symbol
+// (mangled) names. Returns the number of functions whose checks were
+// changed.
+unsigned quala_null_checks_set(const char *module, const char *function,
+                               int enabled);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
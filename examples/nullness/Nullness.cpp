@@ -76,6 +76,11 @@ public:
     return CheckPointerInvariance(LTy, RTy);
   }
 
+  // Only pointers can be inferred nullable.
+  bool Inferable(QualType QT) const {
+    return QT->isPointerType();
+  }
+
   void EmitIncompatibleError(clang::Stmt* S, QualType LTy,
                              QualType RTy) {
     // TODO would be nice if we could give more context about *which* non-null
@@ -94,14 +99,15 @@ protected:
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                  llvm::StringRef) {
     // Construct a type checker for our type system.
-    return llvm::make_unique< TAConsumer<NullnessAnnotator> >(CI, true);
+    return llvm::make_unique< TAConsumer<NullnessAnnotator> >(CI, true, Opts);
   }
 
   bool ParseArgs(const CompilerInstance &CI,
                  const std::vector<std::string>& args) {
-    // No arguments.
-    return true;
+    return Opts.Parse(CI, args);
   }
+
+  TAOptions Opts;
 };
 
 }
@@ -0,0 +1,29 @@
+// RUN: clang -Xclang -verify -Xclang -plugin-arg-nullness -Xclang budget=8 -Xclang -plugin-arg-nullness -Xclang over-budget=conservative -emit-llvm -S -o - %s | FileCheck %s
+// RUN: clang -Xclang -verify -Xclang -plugin-arg-nullness -Xclang budget=8 -emit-llvm -S -o - %s | FileCheck --check-prefix=SKIP %s
+
+// SKIP-NOT: qualaNullCheck
+
+// The checker marks the function it gave up on.
+// CHECK-DAG: c"quala-unchecked\00"
+// CHECK-DAG: @llvm.global.annotations = {{.*}}@big
+
+struct point { int x, y; };
+
+// Within budget, so checked as usual.
+// CHECK-LABEL: define i32 @small(
+// CHECK-NOT: qualaNullCheck
+// CHECK: ret i32
+int small(int *p) {
+  return *p;
+}
+
+// Over budget. In conservative mode, every access through a pointer gets
+// a run-time check.
+// CHECK-LABEL: define i32 @big(
+// CHECK: icmp eq %struct.point* %{{[0-9]+}}, null
+// CHECK: call void @qualaNullCheck
+int big(struct point *a, struct point *b) {  // expected-warning {{type checking 'big' went over its budget of 8 statements; the rest of its body is unchecked}}
+  int s = a->x + a->y;
+  s += b->x * b->y;
+  return s;
+}
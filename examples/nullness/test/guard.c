@@ -0,0 +1,19 @@
+// RUN: clang -mllvm -quala-null-mode=trap -mllvm -quala-null-guard -emit-llvm -S -o - %s | FileCheck %s
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+// CHECK: @quala.null.enabled = private global i8 0
+// CHECK: @quala.null.guards = private constant [1 x { i8*, i8*, i8* }] {{.*}} section "quala_null_guards"
+// CHECK: @__quala_null_runtime = external global i8
+// CHECK: @quala.null.runtime.ref = private constant i8* @__quala_null_runtime
+// CHECK: @llvm.used = appending global {{.*}} @quala.null.runtime.ref
+
+int main(int argc, char **argv) {
+  // CHECK: [[FLAG:%[0-9]+]] = load i8, i8* @quala.null.enabled
+  // CHECK: %quala.enabled = icmp ne i8 [[FLAG]], 0
+  int * NULLABLE foo = 0;
+  // CHECK: %isnull = icmp eq i32* %{{[0-9]+}}, null
+  // CHECK: %isnull.guarded = and i1 %quala.enabled, %isnull
+  // CHECK: br i1 %isnull.guarded, label %quala.trap, label %quala.cont
+  return *foo;
+}
@@ -0,0 +1,25 @@
+// RUN: clang -mllvm -quala-null-mode=trap -mllvm -quala-null-guard -o %t %s ../libqualanull.a
+// RUN: env QUALA_NULL_CHECKS=1 %t > %t.out 2>&1 || true
+// RUN: FileCheck %s < %t.out
+
+// Nothing here calls into the runtime, but it must still be linked in from
+// the archive so that QUALA_NULL_CHECKS turns the checks on.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+static void trapped(int sig) {
+  // CHECK: trapped before the dereference
+  fprintf(stderr, "trapped before the dereference\n");
+  exit(0);
+}
+
+int main(int argc, char **argv) {
+  signal(SIGILL, trapped);
+  signal(SIGTRAP, trapped);
+  int * NULLABLE foo = 0;
+  return *foo;
+}
@@ -0,0 +1,45 @@
+// RUN: clang -mllvm -quala-nonnull -emit-llvm -S -o - %s | FileCheck %s
+
+#include <stdlib.h>
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+// CHECK: define nonnull i32* @self(i32* nonnull %p)
+int *self(int *p) {
+  return p;
+}
+
+// CHECK: define i32* @maybe(i32* %p)
+int * NULLABLE maybe(int * NULLABLE p) {
+  return p;
+}
+
+// CHECK: define i32* @either(i32 %c, i32* nonnull %p)
+int *either(int c, int *p) {
+  // Conditionals are not annotated, so the null here gets through.
+  return c ? p : 0;
+}
+
+// CHECK-LABEL: define i32 @get(
+int get(int **pp, int * NULLABLE *qq) {
+  // The parameter's variable only ever holds the parameter.
+  // CHECK: load i32**, i32*** %pp.addr, align {{[0-9]+}}, !nonnull
+  // Memory in general may have been written by unchecked code.
+  // CHECK: load i32*, i32** %{{[0-9]+}}, align {{[0-9]+}}{{$}}
+  int *p = *pp;
+  // CHECK: load i32*, i32** %{{[0-9a-z.]+}}, align {{[0-9]+}}, !tyann !{{[0-9]+$}}
+  int * NULLABLE q = *qq;
+  return *p + *q;
+}
+
+// Library results were never checked, even when they go through a
+// variable, so the null test stays.
+// CHECK-LABEL: define i32* @alloc()
+// CHECK-NOT: !nonnull
+// CHECK: ret i32*
+int *alloc(void) {
+  int *p = malloc(sizeof(int));
+  if (!p)
+    abort();
+  return p;
+}
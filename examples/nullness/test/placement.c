@@ -0,0 +1,46 @@
+// RUN: clang -mllvm -quala-null-pgo -emit-llvm -S -o - %s | FileCheck %s
+// RUN: clang -mllvm -quala-null-partial=50 -Rpass-analysis=quala-null-checks -emit-llvm -S -o /dev/null %s 2>&1 | FileCheck --check-prefix=PARTIAL %s
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+// The first check covers the second dereference.
+// CHECK-LABEL: define i32 @twice(
+// CHECK: call void @qualaNullCheck
+// CHECK-NOT: call void @qualaNullCheck
+// CHECK: ret i32
+// PARTIAL: remark: null checks in twice: 2 sites, 0 merged, 0 hoisted, 1 dropped
+int twice(int * NULLABLE p) {
+  int a = *p;
+  return a + *p;
+}
+
+// The loop body always runs, so its check moves out of the loop.
+// CHECK-LABEL: define i32 @sum(
+// CHECK: %isnull = icmp eq i32* %p, null
+// CHECK: call void @qualaNullCheck
+// CHECK: do.body:
+// CHECK-NOT: call void @qualaNullCheck
+// CHECK: ret i32
+// PARTIAL: remark: null checks in sum: 1 sites, 0 merged, 0 hoisted, 0 dropped
+int sum(int * NULLABLE p, int n) {
+  int s = 0, i = 0;
+  do {
+    s += *p;
+  } while (++i < n);
+  return s;
+}
+
+// The loop may not run at all, so its check stays put. Partial checking
+// drops it rather than the cold one.
+// CHECK-LABEL: define i32 @hot(
+// CHECK: call void @qualaNullCheck
+// CHECK: for.body:
+// CHECK: call void @qualaNullCheck
+// PARTIAL: remark: null check left out by partial checking (about {{[1-9][0-9]+\.[0-9]}} executions per call)
+// PARTIAL: remark: null checks in hot: 2 sites, 0 merged, 0 hoisted, 1 dropped
+int hot(int * NULLABLE p, int * NULLABLE q, int n) {
+  int s = *q;
+  for (int i = 0; i < n; ++i)
+    s += *p;
+  return s;
+}
@@ -0,0 +1,17 @@
+// RUN: clang -mllvm -quala-null-mode=runtime -emit-llvm -S -o - %s | FileCheck %s
+// RUN: clang -mllvm -quala-null-mode=runtime -mllvm -quala-null-recover -emit-llvm -S -o - %s | FileCheck --check-prefix=RECOVER %s
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+// CHECK: @quala.null.sites = private constant [1 x { i32, i32, i32, i8* }] {{.*}} section "quala_null_sites"
+// CHECK: @llvm.used = appending global {{.*}} @quala.null.sites
+
+int main(int argc, char **argv) {
+  int * NULLABLE foo = 0;
+  // CHECK: br i1 %isnull, label %{{[0-9]+}}, label %{{[0-9]+}}, !prof
+  // CHECK: call void @__quala_null_report_abort(i32 {{-?[0-9]+}})
+  // CHECK-NEXT: unreachable
+  // RECOVER: call void @__quala_null_report(i32 {{-?[0-9]+}})
+  // RECOVER-NEXT: br label
+  return *foo;
+}
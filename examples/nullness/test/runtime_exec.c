@@ -0,0 +1,50 @@
+// RUN: clang -g -mllvm -quala-null-mode=runtime -mllvm -quala-null-recover -o %t %s ../libqualanull.a
+// RUN: %t > %t.out 2>&1
+// RUN: FileCheck %s < %t.out
+// RUN: clang -g -mllvm -quala-null-mode=runtime -o %t.abort %s ../libqualanull.a
+// RUN: %t.abort > %t.abort.out 2>&1 || true
+// RUN: FileCheck --check-prefix=ABORT %s < %t.abort.out
+
+// Each failing site is reported at its own file and line, once, however
+// often it fails. The dereference itself still faults after a recovered
+// report, so a handler skips past it.
+
+#include <setjmp.h>
+#include <signal.h>
+#include <stdio.h>
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+static sigjmp_buf recovered;
+
+static void faulted(int sig) {
+  siglongjmp(recovered, 1);
+}
+
+static int load(int * NULLABLE p) {
+  return *p;  // CHECK: runtime_exec.c:[[@LINE]]:{{[0-9]+}}: quala: null dereference
+  // ABORT: runtime_exec.c:[[@LINE-1]]:{{[0-9]+}}: quala: null dereference
+}
+
+static void store(int * NULLABLE p) {
+  *p = 1;  // CHECK: runtime_exec.c:[[@LINE]]:{{[0-9]+}}: quala: null dereference
+}
+
+int main() {
+  signal(SIGSEGV, faulted);
+  signal(SIGBUS, faulted);
+  for (int i = 0; i < 3; ++i) {
+    if (!sigsetjmp(recovered, 1))
+      load(0);
+    if (!sigsetjmp(recovered, 1))
+      store(0);
+  }
+  fprintf(stderr, "done\n");
+  return 0;
+}
+
+// CHECK-NOT: null dereference
+// CHECK: done
+
+// ABORT-NOT: null dereference
+// ABORT-NOT: done
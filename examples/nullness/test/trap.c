@@ -0,0 +1,23 @@
+// RUN: clang -mllvm -quala-null-mode=trap -emit-llvm -S -o - %s | FileCheck %s
+
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+int main(int argc, char **argv) {
+  int * NULLABLE foo = 0;
+  int * NULLABLE bar = 0;
+  // Each site traps in its own block, so the trapping PC identifies it.
+  // CHECK: %isnull = icmp eq i32* %{{[0-9]+}}, null
+  // CHECK: br i1 %isnull, label %[[TRAP1:quala.trap[0-9]*]], label %quala.cont, !prof
+  // CHECK: br i1 %isnull{{[0-9]+}}, label %[[TRAP2:quala.trap[0-9]*]], label %quala.cont{{[0-9]+}}, !prof
+  // CHECK-NOT: qualaNullCheck
+  return *foo + *bar;
+}
+
+// CHECK: [[TRAP1]]:
+// CHECK-NEXT: call void asm sideeffect "", "i"(i32 0)
+// CHECK-NEXT: call void @llvm.trap()
+// CHECK-NEXT: unreachable
+// CHECK: [[TRAP2]]:
+// CHECK-NEXT: call void asm sideeffect "", "i"(i32 1)
+// CHECK-NEXT: call void @llvm.trap()
+// CHECK-NEXT: unreachable
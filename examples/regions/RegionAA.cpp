@@ -0,0 +1,179 @@
+#include "llvm/Pass.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/Attributes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
+
+#include "AnnotationInfo.h"
+
+#include <cstring>
+
+using namespace llvm;
+
+namespace {
+
+// Where a value's region is kept once its annotated alloca is gone.
+const char *const RegionAttr = "quala-region";
+
+const char *const RegionPrefix = "region:";
+
+bool isRegion(StringRef Ann) {
+  return Ann.startswith(RegionPrefix);
+}
+
+// Clang's annotations live on allocas, loads, and stores, most of which
+// mem2reg and SROA delete before the optimizations that need alias
+// information. This runs first and moves each region to where it survives:
+//
+// * Parameters spilled to an annotated `.addr` alloca get a "quala-region"
+//   attribute.
+// * Values stored into an annotated alloca (e.g., the result of malloc)
+//   get a `tyann` of their own.
+struct RegionTags : public FunctionPass {
+  static char ID;
+  RegionTags() : FunctionPass(ID) {}
+
+  virtual void getAnalysisUsage(AnalysisUsage &Info) const {
+    Info.addRequired<AnnotationInfo>();
+    Info.setPreservesCFG();
+  }
+
+  virtual bool runOnFunction(Function &F) {
+    AnnotationInfo &AI = getAnalysis<AnnotationInfo>();
+    LLVMContext &Ctx = F.getContext();
+    bool modified = false;
+
+    for (auto &BB : F) {
+      for (auto &I : BB) {
+        auto *SI = dyn_cast<StoreInst>(&I);
+        if (!SI || !isa<AllocaInst>(SI->getPointerOperand()))
+          continue;
+
+        StringRef Ann;
+        uint8_t Level;
+        if (!AI.getAnnotation(SI->getPointerOperand(), Ann, Level) ||
+            Level != 1 || !isRegion(Ann))
+          continue;
+
+        Value *V = SI->getValueOperand()->stripPointerCasts();
+        if (auto *Arg = dyn_cast<Argument>(V)) {
+          AttrBuilder B;
+          B.addAttribute(RegionAttr, Ann.substr(strlen(RegionPrefix)));
+          Arg->addAttr(AttributeSet::get(Ctx, Arg->getArgNo() + 1, B));
+          modified = true;
+        } else if (auto *VI = dyn_cast<Instruction>(V)) {
+          StringRef Old;
+          uint8_t OldLevel;
+          if (!AI.getAnnotation(VI, Old, OldLevel) || !isRegion(Old)) {
+            Metadata *Ops[] = {
+              MDString::get(Ctx, Ann),
+              ConstantAsMetadata::get(
+                ConstantInt::get(Type::getInt8Ty(Ctx), 0)),
+            };
+            VI->setMetadata("tyann", MDNode::get(Ctx, Ops));
+            modified = true;
+          }
+        }
+      }
+    }
+
+    return modified;
+  }
+};
+
+// An alias analysis for the regions type system. The checker guarantees
+// that a pointer in one region never points into another, so accesses
+// through pointers in different regions cannot alias. Everything else is
+// left to the rest of the chain.
+struct RegionAA : public ImmutablePass, public AliasAnalysis {
+  static char ID;
+  RegionAA() : ImmutablePass(ID) {}
+
+  virtual bool doInitialization(Module &M) {
+    InitializeAliasAnalysis(this, &M.getDataLayout());
+    return true;
+  }
+
+  virtual void getAnalysisUsage(AnalysisUsage &Info) const {
+    AliasAnalysis::getAnalysisUsage(Info);
+    Info.addRequired<AnnotationInfo>();
+    Info.setPreservesAll();
+  }
+
+  // Multiple inheritance: make sure the pass manager gets the AliasAnalysis
+  // part when it asks for one.
+  virtual void *getAdjustedAnalysisPointer(const void *PI) {
+    if (PI == &AliasAnalysis::ID)
+      return (AliasAnalysis*)this;
+    return this;
+  }
+
+  virtual AliasResult alias(const MemoryLocation &LocA,
+                            const MemoryLocation &LocB) {
+    StringRef RA = regionOf(LocA.Ptr);
+    StringRef RB = regionOf(LocB.Ptr);
+    if (!RA.empty() && !RB.empty() && RA != RB)
+      return NoAlias;
+    return AliasAnalysis::alias(LocA, LocB);
+  }
+
+  // The name of the region of the object a pointer is based on, or an
+  // empty string.
+  StringRef regionOf(const Value *Ptr) {
+    const Value *Obj = GetUnderlyingObject(Ptr, *DL);
+
+    if (auto *Arg = dyn_cast<Argument>(Obj)) {
+      Attribute A = Arg->getParent()->getAttributes().getAttribute(
+          Arg->getArgNo() + 1, RegionAttr);
+      if (A.isStringAttribute())
+        return A.getValueAsString();
+      return StringRef();
+    }
+
+    StringRef Ann;
+    uint8_t Level;
+    AnnotationInfo &AI = getAnalysis<AnnotationInfo>();
+    if (AI.getAnnotation(const_cast<Value*>(Obj), Ann, Level) &&
+        Level == 0 && isRegion(Ann))
+      return Ann.substr(strlen(RegionPrefix));
+    return StringRef();
+  }
+};
+
+}
+
+char RegionTags::ID = 0;
+char RegionAA::ID = 0;
+static RegisterPass<RegionTags> X("region-tags",
+                                  "move region annotations to SSA values",
+                                  true,
+                                  false);
+static RegisterPass<RegionAA> Y("region-aa",
+                                "region-based alias analysis",
+                                false,
+                                true);
+static RegisterAnalysisGroup<AliasAnalysis> Z(Y);
+
+// Tag before anything promotes the annotated allocas...
+static void registerTags(const PassManagerBuilder &,
+                         legacy::PassManagerBase &PM) {
+  PM.add(new RegionTags());
+}
+static RegisterStandardPasses
+  RegisterTags(PassManagerBuilder::EP_EarlyAsPossible, registerTags);
+
+// ...and put the alias analysis at the front of the chain for the module
+// optimizations (it is only consulted when optimizing).
+static void registerAA(const PassManagerBuilder &,
+                       legacy::PassManagerBase &PM) {
+  PM.add(new RegionAA());
+}
+static RegisterStandardPasses
+  RegisterAA(PassManagerBuilder::EP_ModuleOptimizerEarly, registerAA);
@@ -0,0 +1,219 @@
+#include "TypeAnnotations.h"
+
+#include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/Support/raw_ostream.h"
+#include "clang/Basic/Builtins.h"
+using namespace clang;
+
+namespace {
+
+#define REGION_PREFIX "region:"
+#define FRESH_ANN "fresh"
+
+class RegionAnnotator: public Annotator<RegionAnnotator> {
+public:
+  RegionAnnotator(CompilerInstance &ci, bool instrument)
+      : Annotator(ci, instrument) {};
+
+  // Get the region a pointer type points into, or an empty string for
+  // pointers not in any region.
+  template <typename T>
+  StringRef region(const T V) const {
+    StringRef Ann = AnnotationOf(V);
+    if (Ann.startswith(REGION_PREFIX))
+      return Ann;
+    return StringRef();
+  }
+
+  // Fresh pointers (null and newly allocated memory) alias nothing yet, so
+  // they may enter any region.
+  template <typename T>
+  bool fresh(const T V) const {
+    return AnnotationOf(V).equals(FRESH_ANN);
+  }
+
+  // Only the checker may call a pointer fresh. A type written with "fresh"
+  // would let any pointer into any region, so reject it wherever a type is
+  // spelled: in declarations and in expressions that name a type.
+  bool spelledFresh(QualType T, SourceLocation Loc) const {
+    if (!SpellsAnnotation(T, FRESH_ANN))
+      return false;
+    unsigned did = Diags().getCustomDiagID(
+      DiagnosticsEngine::Error,
+      "'" FRESH_ANN "' is reserved for null and newly allocated pointers"
+    );
+    Diags().Report(Loc, did);
+    return true;
+  }
+
+  void CheckDecl(ValueDecl *D) {
+    // Parameters are declarations of their own.
+    QualType T = D->getType();
+    if (auto *FD = dyn_cast<FunctionDecl>(D))
+      T = FD->getReturnType();
+    spelledFresh(T, D->getLocation());
+  }
+  void VisitCompoundLiteralExpr(CompoundLiteralExpr *E) {
+    spelledFresh(E->getType(), E->getLocStart());
+  }
+  void VisitVAArgExpr(VAArgExpr *E) {
+    spelledFresh(E->getType(), E->getLocStart());
+  }
+  void VisitCXXNewExpr(CXXNewExpr *E) {
+    spelledFresh(E->getAllocatedType(), E->getLocStart());
+  }
+
+  void VisitIntegerLiteral(IntegerLiteral *E) {
+    if (E->getValue() == 0) {
+      AddAnnotation(E, FRESH_ANN);
+    }
+  }
+  void VisitGNUNullExpr(GNUNullExpr *E) {
+    AddAnnotation(E, FRESH_ANN);
+  }
+
+  // Allocators: anything declared __attribute__((malloc)), plus the C
+  // library's (which not every libc declares that way).
+  void VisitCallExpr(CallExpr *E) {
+    Annotator<RegionAnnotator>::VisitCallExpr(E);
+    FunctionDecl *D = E->getDirectCallee();
+    if (!D)
+      return;
+    unsigned biid = D->getBuiltinID();
+    if (D->hasAttr<RestrictAttr>() || biid == Builtin::BImalloc ||
+        biid == Builtin::BIcalloc) {
+      AddAnnotation(E, FRESH_ANN);
+    }
+  }
+
+  // C code casts malloc's result, and C's NULL is a cast of 0. A cast that
+  // does not name a region keeps a fresh pointer fresh, and only a fresh
+  // pointer may be cast into a region. Otherwise a cast could put two
+  // aliasing pointers in different regions, and the alias analysis would
+  // trust that. Dropping a region is fine, as it is for assignments.
+  void VisitExplicitCastExpr(ExplicitCastExpr *E) {
+    if (spelledFresh(E->getTypeAsWritten(), E->getLocStart()))
+      return;
+
+    Expr *Sub = E->getSubExpr();
+    if (fresh(Sub)) {
+      if (!AnnotationOf(E).size())
+        AddAnnotation(E, FRESH_ANN);
+      return;
+    }
+
+    QualType To = TypeOf(E);
+    QualType From = TypeOf(Sub);
+    StringRef L = region(To);
+    StringRef R = region(From);
+    if (L.size() && L != R) {
+      unsigned did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "cast moves a pointer from %0 into %1"
+      );
+      Diags().Report(E->getLocStart(), did)
+          << (R.size() ? R : "no region") << L
+          << CharSourceRange(E->getSourceRange(), false);
+    } else if (To->isPointerType() && From->isPointerType() &&
+               !SamePointerTypeAnnotations(To, From, false)) {
+      unsigned did = Diags().getCustomDiagID(
+        DiagnosticsEngine::Error,
+        "cast changes the regions under a pointer"
+      );
+      Diags().Report(E->getLocStart(), did)
+          << CharSourceRange(E->getSourceRange(), false);
+    }
+  }
+
+  // Pointer arithmetic stays in the pointer's region.
+  void VisitBinaryOperator(BinaryOperator *E) {
+    if (E->getType()->isPointerType()) {
+      if (E->getLHS()->getType()->isPointerType()) {
+        AddAnnotation(E, AnnotationOf(E->getLHS()));
+      } else {
+        AddAnnotation(E, AnnotationOf(E->getRHS()));
+      }
+    }
+  }
+
+  // So does taking the address of an element.
+  void VisitUnaryOperator(UnaryOperator *E) {
+    if (E->getOpcode() == UO_AddrOf) {
+      Expr *Sub = E->getSubExpr()->IgnoreParens();
+      if (auto *ASE = dyn_cast<ArraySubscriptExpr>(Sub)) {
+        AddAnnotation(E, region(ASE->getBase()));
+      } else if (auto *UO = dyn_cast<UnaryOperator>(Sub)) {
+        if (UO->getOpcode() == UO_Deref)
+          AddAnnotation(E, region(UO->getSubExpr()));
+      }
+    } else if (E->isIncrementDecrementOp()) {
+      AddAnnotation(E, AnnotationOf(E->getSubExpr()));
+    }
+  }
+
+  // A conditional is in a region if both of its arms are.
+  void VisitConditionalOperator(ConditionalOperator *E) {
+    StringRef T = AnnotationOf(E->getTrueExpr());
+    StringRef F = AnnotationOf(E->getFalseExpr());
+    if (T == F || F == FRESH_ANN) {
+      AddAnnotation(E, T);
+    } else if (T == FRESH_ANN) {
+      AddAnnotation(E, F);
+    }
+  }
+
+  // Subtyping judgment. A pointer in a region may only come from the same
+  // region or be fresh. Dropping the region is fine: the alias analysis
+  // makes no claims about unannotated pointers.
+  bool Compatible(QualType LTy, QualType RTy) const {
+    if (LTy->isPointerType()) {
+      StringRef L = region(LTy);
+      if (L.size() && !fresh(RTy) && region(RTy) != L) {
+        return false;
+      }
+    }
+    return CheckPointerInvariance(LTy, RTy);
+  }
+
+  void EmitIncompatibleError(clang::Stmt* S, QualType LTy,
+                             QualType RTy) {
+    StringRef L = region(LTy);
+    StringRef R = region(RTy);
+    if (L == R) {
+      // The regions below the top level differ.
+      Annotator<RegionAnnotator>::EmitIncompatibleError(S, LTy, RTy);
+      return;
+    }
+
+    unsigned did = Diags().getCustomDiagID(
+      DiagnosticsEngine::Error,
+      "pointer from %0 flows into %1"
+    );
+    Diags().Report(S->getLocStart(), did)
+        << (R.size() ? R : "no region")
+        << (L.size() ? L : "no region")
+        << CharSourceRange(S->getSourceRange(), false);
+  }
+};
+
+class RegionsAction : public PluginASTAction {
+protected:
+  std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
+                                                 llvm::StringRef) {
+    // Construct a type checker for our type system.
+    return llvm::make_unique< TAConsumer<RegionAnnotator> >(CI, true, Opts);
+  }
+
+  bool ParseArgs(const CompilerInstance &CI,
+                 const std::vector<std::string>& args) {
+    return Opts.Parse(CI, args);
+  }
+
+  TAOptions Opts;
+};
+
+}
+
+static FrontendPluginRegistry::Add<RegionsAction>
+X("regions", "disjoint memory regions");
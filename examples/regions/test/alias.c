@@ -0,0 +1,25 @@
+// RUN: clang -O2 -emit-llvm -S -o - %s | FileCheck %s
+
+#define REGION(r) __attribute__((type_annotate("region:" #r)))
+
+// The store through b cannot change a[0], so the second load goes away.
+// CHECK-LABEL: define double @reload(double* {{.*}}"quala-region"="A" %a, double* {{.*}}"quala-region"="B" %b)
+// CHECK: load double
+// CHECK-NOT: load double
+// CHECK: ret double
+double reload(double * REGION(A) a, double * REGION(B) b) {
+  double x = a[0];
+  b[0] = 1.0;
+  return x + a[0];
+}
+
+// Without regions, they might alias.
+// CHECK-LABEL: define double @plain(
+// CHECK: load double
+// CHECK: load double
+// CHECK: ret double
+double plain(double *a, double *b) {
+  double x = a[0];
+  b[0] = 1.0;
+  return x + a[0];
+}
@@ -0,0 +1,20 @@
+// RUN: clang -fsyntax-only -Xclang -verify %s
+
+#include <stdlib.h>
+
+#define REGION(r) __attribute__((type_annotate("region:" #r)))
+
+void casts(double * REGION(A) a, double *plain) {
+  // Only fresh memory may be cast into a region.
+  double * REGION(A) fresh = (double * REGION(A))malloc(sizeof(double));
+  double * REGION(B) b = (double * REGION(B))a;  // expected-error {{cast moves a pointer from region:A into region:B}}
+  double * REGION(A) c = (double * REGION(A))plain;  // expected-error {{cast moves a pointer from no region into region:A}}
+
+  // Staying in a region or leaving it is fine.
+  char * REGION(A) bytes = (char * REGION(A))a;
+  double *out = (double *)a;
+
+  // So is leaving the regions under a pointer alone.
+  double * REGION(A) *pa = (double * REGION(A) *)&a;
+  double **pp = (double **)&a;  // expected-error {{cast changes the regions under a pointer}}
+}
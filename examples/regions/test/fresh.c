@@ -0,0 +1,31 @@
+// RUN: clang -fsyntax-only -Xclang -verify %s
+
+#include <stdarg.h>
+
+#define REGION(r) __attribute__((type_annotate("region:" #r)))
+#define FRESH __attribute__((type_annotate("fresh")))
+
+// Only null and newly allocated pointers are fresh. Writing "fresh" would
+// let an aliasing pointer into any region.
+typedef double * FRESH fresh_ptr;
+
+double * FRESH make(void);  // expected-error {{'fresh' is reserved}}
+void take(double * FRESH p);  // expected-error {{'fresh' is reserved}}
+
+struct box {
+  double * FRESH p;  // expected-error {{'fresh' is reserved}}
+};
+
+void launder(double * REGION(A) a, double *plain, ...) {
+  double * FRESH f = plain;  // expected-error {{'fresh' is reserved}}
+  fresh_ptr g = plain;  // expected-error {{'fresh' is reserved}}
+  double * FRESH *pf;  // expected-error {{'fresh' is reserved}}
+
+  a = (double * FRESH)plain;  // expected-error {{'fresh' is reserved}}
+  a = (fresh_ptr)plain;  // expected-error {{'fresh' is reserved}}
+
+  va_list ap;
+  va_start(ap, plain);
+  a = va_arg(ap, fresh_ptr);  // expected-error {{'fresh' is reserved}}
+  va_end(ap);
+}
@@ -0,0 +1,33 @@
+// RUN: clang -fsyntax-only -Xclang -verify %s
+
+#include <stdlib.h>
+
+#define REGION(r) __attribute__((type_annotate("region:" #r)))
+
+void scale(double * REGION(A) a, double * REGION(B) b, int n) {
+  for (int i = 0; i < n; ++i)
+    a[i] = 2.0 * b[i];
+}
+
+int main() {
+  double * REGION(A) a = malloc(10 * sizeof(double));
+  double * REGION(B) b = (double *)calloc(10, sizeof(double));
+  double * REGION(A) c = 0;
+  double *plain;
+
+  c = a + 5;
+  c = &a[2];
+  b = a;  // expected-error {{pointer from region:A flows into region:B}}
+  plain = a;
+  a = plain;  // expected-error {{pointer from no region flows into region:A}}
+
+  scale(a, b, 10);
+  scale(b, a, 10);  // expected-error {{pointer from region:B flows into region:A}} \
+      expected-error {{pointer from region:A flows into region:B}}
+
+  // Regions under pointers must match exactly.
+  double * REGION(A) *pa = &a;
+  double **pp = &a;  // expected-error {{incompatible}}
+
+  return 0;
+}
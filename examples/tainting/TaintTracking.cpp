@@ -100,14 +100,15 @@ protected:
   std::unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI,
                                                  llvm::StringRef) {
     // Construct a type checker for our type system.
-    return llvm::make_unique< TAConsumer<TaintAnnotator> >(CI, true);
+    return llvm::make_unique< TAConsumer<TaintAnnotator> >(CI, true, Opts);
   }
 
   bool ParseArgs(const CompilerInstance &CI,
                  const std::vector<std::string>& args) {
-    // No arguments.
-    return true;
+    return Opts.Parse(CI, args);
   }
+
+  TAOptions Opts;
 };
 
 }
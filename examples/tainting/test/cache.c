@@ -0,0 +1,32 @@
+// RUN: rm -rf %t.dir
+// RUN: clang -fsyntax-only -Xclang -verify -Xclang -plugin-arg-taint-tracking -Xclang cache=%t.dir %s
+// RUN: clang -fsyntax-only -Xclang -verify -Xclang -plugin-arg-taint-tracking -Xclang cache=%t.dir -Xclang -plugin-arg-taint-tracking -Xclang time-trace=%t.json %s
+// RUN: FileCheck %s < %t.json
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+TAINTED int source(void);
+void sink(int x);
+
+// The second run replays every function's diagnostics from the cache.
+// CHECK: {"name":"Cache","ph":"C"
+// CHECK-DAG: "hits":4
+// CHECK-DAG: "misses":0
+
+void a(void) {
+  sink(source());  // expected-error {{incompatible}}
+}
+
+int c(TAINTED int p) {
+  if (p)  // expected-error {{tainted}}
+    return p;  // expected-error {{incompatible}}
+  return 0;
+}
+
+TAINTED int d(TAINTED int p) {
+  return p * 2;
+}
+
+int e(void) {
+  return source();  // expected-error {{incompatible}}
+}
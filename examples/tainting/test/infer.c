@@ -0,0 +1,35 @@
+// RUN: rm -rf %t.dir
+// RUN: clang -fsyntax-only -Xclang -plugin-arg-taint-tracking -Xclang infer=%t.dir %s
+// RUN: cat %t.dir/infer.c-*.qsum | FileCheck %s
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+#define ENDORSE(e) __builtin_annotation((e), "endorse")
+
+TAINTED int input;
+int global = 0;
+
+int id(int p) {
+  return p;
+}
+
+int main() {
+  int a = input;
+  int b;
+  b = id(a) + 1;
+  global = ENDORSE(b);
+  return 0;
+}
+
+// CHECK: quala-summary 1
+// CHECK-DAG: n	[[INPUT:[0-9]+]]	input	tainted	{{.*}}infer.c:8:13	input
+// CHECK-DAG: n	[[P:[0-9]+]]	param:id:0	-	{{.*}}infer.c:11:12	p
+// CHECK-DAG: n	[[RET:[0-9]+]]	ret:id	-	{{.*}}infer.c:11:5	id (return)
+// CHECK-DAG: n	[[A:[0-9]+]]	local:{{.*}}infer.c:{{[0-9]+}}	-	{{.*}}infer.c:16:7	a
+// CHECK-DAG: n	[[B:[0-9]+]]	local:{{.*}}infer.c:{{[0-9]+}}	-	{{.*}}infer.c:17:7	b
+// CHECK-DAG: n	[[GLOBAL:[0-9]+]]	global	-	{{.*}}infer.c:9:5	global
+// CHECK-DAG: n	[[UNTAINTED:[0-9]+]]	const:untainted	untainted	-	untainted
+// CHECK-DAG: f	[[P]]	[[RET]]
+// CHECK-DAG: f	[[INPUT]]	[[A]]
+// CHECK-DAG: f	[[A]]	[[P]]
+// CHECK-DAG: f	[[RET]]	[[B]]
+// CHECK-DAG: f	[[UNTAINTED]]	[[GLOBAL]]
@@ -0,0 +1,43 @@
+// Two files with the same name in different directories, each compiled
+// from its own directory (as under a recursive make), must keep separate
+// summaries and separate statics.
+// RUN: rm -rf %t && mkdir -p %t/a %t/b
+// RUN: cp %s %t/a/same.c && cp %s %t/b/same.c
+// RUN: (cd %t/a && %S/../ttclang -fsyntax-only -DFIRST -Xclang -plugin-arg-taint-tracking -Xclang infer=../sum same.c)
+// RUN: (cd %t/b && %S/../ttclang -fsyntax-only -Xclang -plugin-arg-taint-tracking -Xclang infer=../sum same.c)
+// RUN: ls %t/sum | FileCheck --check-prefix=FILES %s
+// RUN: quala-infer -qual=tainted -o %t/out %t/sum 2> %t/err
+// RUN: FileCheck %s < %t/out
+// RUN: FileCheck --check-prefix=NOT %s < %t/out
+// RUN: FileCheck --check-prefix=STATS %s < %t/err
+
+// FILES: same.c-{{[0-9a-f]+}}.qsum
+// FILES-NEXT: same.c-{{[0-9a-f]+}}.qsum
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+void sink(int p);
+
+#ifdef FIRST
+static TAINTED int secret;
+static int copy;  // CHECK-DAG: same.c:[[@LINE]]:12: note: infer 'tainted' for 'copy'
+
+void sink(int p) {  // CHECK-DAG: note: infer 'tainted' for 'p' (from 'input'
+  int seen = p;  // CHECK-DAG: same.c:[[@LINE]]:7: note: infer 'tainted' for 'seen'
+}
+
+void first(void) {
+  copy = secret;
+}
+#else
+static int copy;  // NOT-NOT: same.c:[[@LINE]]:
+
+TAINTED int input;
+
+void second(void) {
+  int clean = copy;  // NOT-NOT: same.c:[[@LINE]]:
+  sink(input);
+}
+#endif
+
+// STATS: 3 suggestions
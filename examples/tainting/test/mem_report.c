@@ -0,0 +1,15 @@
+// RUN: clang -fsyntax-only -Xclang -plugin-arg-taint-tracking -Xclang mem-report %s 2>&1 | FileCheck %s
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+int main() {
+  TAINTED int x = 1;
+  TAINTED int y = x + 1;
+  TAINTED int z = x + y;
+  return 0;
+}
+
+// CHECK: *** Type checker memory report
+// CHECK-NEXT: AST memory without the checker: {{[0-9]+}} bytes
+// CHECK-NEXT: AST memory added by the checker: {{[0-9]+}} bytes ({{[0-9.]+}}%)
+// CHECK-NEXT: annotations added: {{[0-9]+}} created, {{[0-9]+}} reused, {{[0-9]+}} already present
@@ -0,0 +1,32 @@
+// RUN: clang -fsyntax-only -Xclang -verify -Xclang -plugin-arg-taint-tracking -Xclang jobs=4 %s
+// RUN: clang -fsyntax-only -Xclang -plugin-arg-taint-tracking -Xclang jobs=4 %s > %t 2>&1 || true
+// RUN: FileCheck %s < %t
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+TAINTED int source(void);
+void sink(int x);
+
+// Diagnostics come out in declaration order, whichever thread found them.
+// CHECK: parallel.c:[[@LINE+2]]:{{[0-9]+}}: error: tainted incompatible with unannotated
+void a(void) {
+  sink(source());  // expected-error {{incompatible}}
+}
+
+// CHECK: parallel.c:[[@LINE+3]]:{{[0-9]+}}: error: tainted incompatible with unannotated
+void b(void) {
+  TAINTED int x = source();
+  int y = x + 1;  // expected-error {{incompatible}}
+  sink(y);
+}
+
+// CHECK: parallel.c:[[@LINE+3]]:{{[0-9]+}}: error: tainted incompatible with unannotated
+int c(TAINTED int p) {
+  if (p)  // expected-error {{tainted}}
+    return p;  // expected-error {{incompatible}}
+  return 0;
+}
+
+TAINTED int d(TAINTED int p) {
+  return p * 2;
+}
@@ -0,0 +1,21 @@
+// RUN: clang++ -fsyntax-only -Xclang -verify %s
+// RUN: clang++ -fsyntax-only -Xclang -verify -Xclang -plugin-arg-taint-tracking -Xclang jobs=4 %s
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+TAINTED int source();
+void sink(int x);
+
+// A system header included inside a user declaration. Its declarations are
+// skipped whether or not checking is parallel.
+extern "C" {
+# 1 "system.h" 1 3
+static inline void from_header() {
+  sink(source());
+}
+# 17 "parallel_headers.cpp" 2
+}
+
+void user() {
+  sink(source());  // expected-error {{incompatible}}
+}
@@ -0,0 +1,18 @@
+// RUN: clang -fsyntax-only -Xclang -plugin-arg-taint-tracking -Xclang time-trace=%t.json %s
+// RUN: FileCheck %s < %t.json
+
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+typedef TAINTED int tint;
+
+int add(tint a, int b) {
+  tint c = a + b;
+  return b;
+}
+
+// CHECK: "traceEvents":
+// CHECK-DAG: {"name":"TopLevelDecl",{{.*}}"args":{"detail":"add"}}
+// CHECK-DAG: {"name":"Function",{{.*}}"args":{"detail":"add"}}
+// CHECK-DAG: {"name":"Visit","ph":"C",{{.*}}"BinaryOperator":1
+// CHECK-DAG: {"name":"AnnotationOf","ph":"C",{{.*}}"desugaring steps":
+// CHECK-DAG: {"name":"AddAnnotation","ph":"C",{{.*}}"types created":
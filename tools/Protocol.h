@@ -0,0 +1,24 @@
+#ifndef QUALA_PROTOCOL_H
+#define QUALA_PROTOCOL_H
+
+// The quala-client to quala-server protocol. A client connects to the
+// server's Unix socket and sends one QualaJobHeader, with its stdin, stdout,
+// and stderr descriptors attached as SCM_RIGHTS ancillary data. Then it sends
+// Size bytes of NUL-terminated strings: the working directory, Argc
+// arguments (starting with the compiler's path), and Envc NAME=VALUE
+// environment entries. The server runs the job with the client's
+// descriptors and replies with the exit status as an int32_t.
+
+#include <stdint.h>
+
+#define QUALA_PROTOCOL_MAGIC 0x51554131  /* "QUA1" */
+#define QUALA_MAX_JOB_SIZE (64 * 1024 * 1024)
+
+struct QualaJobHeader {
+  uint32_t Magic;
+  uint32_t Argc;
+  uint32_t Envc;
+  uint32_t Size;
+};
+
+#endif
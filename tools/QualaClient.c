@@ -0,0 +1,125 @@
+// quala-client: send a compile to a running quala-server.
+//
+// Usage: quala-client COMPILER ARGS...
+//
+// If QUALA_SERVER names the server's socket, the client hands the job
+// (including its own stdin, stdout, and stderr) to the server and exits with
+// the job's status. Otherwise, or if the server cannot be reached, it just
+// runs COMPILER ARGS... itself, so builds never depend on the server being
+// up.
+
+#include "Protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+extern char **environ;
+
+static int connectTo(const char *path) {
+  struct sockaddr_un addr;
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0)
+    return -1;
+  if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+static int writeFully(int fd, const char *buf, size_t size) {
+  while (size) {
+    ssize_t n = write(fd, buf, size);
+    if (n <= 0)
+      return 0;
+    buf += n;
+    size -= n;
+  }
+  return 1;
+}
+
+// Append a NUL-terminated string to a growing buffer.
+static void append(char **buf, size_t *size, size_t *cap, const char *s) {
+  size_t len = strlen(s) + 1;
+  if (*size + len > *cap) {
+    *cap = (*size + len) * 2;
+    *buf = realloc(*buf, *cap);
+    if (!*buf) {
+      perror("quala-client");
+      exit(1);
+    }
+  }
+  memcpy(*buf + *size, s, len);
+  *size += len;
+}
+
+// Send the job. Returns 0 if the server did not take it.
+static int sendJob(int sock, int argc, char **argv) {
+  char *buf = NULL;
+  size_t size = 0, cap = 0;
+  char cwd[4096];
+  if (!getcwd(cwd, sizeof(cwd)))
+    return 0;
+  append(&buf, &size, &cap, cwd);
+  for (int i = 0; i < argc; ++i)
+    append(&buf, &size, &cap, argv[i]);
+  uint32_t envc = 0;
+  for (char **e = environ; *e; ++e, ++envc)
+    append(&buf, &size, &cap, *e);
+
+  struct QualaJobHeader header = { QUALA_PROTOCOL_MAGIC, argc, envc, size };
+  int fds[3] = { 0, 1, 2 };
+  char control[CMSG_SPACE(sizeof(fds))];
+  struct iovec iov = { &header, sizeof(header) };
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  memset(control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  int ok = sendmsg(sock, &msg, 0) == sizeof(header) &&
+           writeFully(sock, buf, size);
+  free(buf);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s compiler [args...]\n", argv[0]);
+    return 1;
+  }
+
+  const char *path = getenv("QUALA_SERVER");
+  int sock = path ? connectTo(path) : -1;
+  if (sock >= 0 && sendJob(sock, argc - 1, argv + 1)) {
+    int32_t status;
+    if (read(sock, &status, sizeof(status)) == sizeof(status))
+      return status;
+    // The server went away mid-job. Its output may be partial, so don't
+    // retry behind the user's back.
+    fprintf(stderr, "quala-client: lost connection to quala-server\n");
+    return 1;
+  }
+
+  // No server: compile locally.
+  execvp(argv[1], argv + 1);
+  perror("quala-client");
+  return 127;
+}
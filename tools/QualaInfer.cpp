@@ -0,0 +1,229 @@
+// quala-infer: whole-program qualifier inference.
+//
+// Checkers run with the infer=DIR plugin argument write one constraint
+// summary per translation unit into DIR (see Inference.h). This tool merges
+// all the summaries and suggests an annotation for every unannotated
+// declaration that a value with the annotation can flow into: for example,
+// every pointer that may receive a null with -qual=nullable, or every
+// variable that tainted data reaches with -qual=tainted. Declarations that
+// carry some other annotation (e.g., an endorsement) stop the flow.
+//
+// The summaries are read one at a time, and only the interned node keys and
+// the flow edges stay in memory. Solving is a single breadth-first search
+// over the merged flow graph, so it takes linear time in the number of
+// constraints.
+//
+// Usage: quala-infer -qual=ANNOTATION [-o FILE] SUMMARY-OR-DIR...
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(cl::Positional, cl::OneOrMore,
+    cl::desc("<summary files or directories>"));
+static cl::opt<std::string> Qual("qual", cl::Required,
+    cl::desc("Annotation to infer"), cl::value_desc("annotation"));
+static cl::opt<std::string> Output("o", cl::init("-"),
+    cl::desc("Write suggestions to this file"), cl::value_desc("filename"));
+
+namespace {
+
+class Solver {
+public:
+  // Add one TU's summary to the graph.
+  bool read(StringRef Path) {
+    ErrorOr< std::unique_ptr<MemoryBuffer> > Buf = MemoryBuffer::getFile(Path);
+    if (!Buf) {
+      errs() << Path << ": " << Buf.getError().message() << "\n";
+      return false;
+    }
+
+    line_iterator Line(**Buf);
+    if (Line.is_at_eof() || *Line != "quala-summary 1") {
+      errs() << Path << ": not a Quala constraint summary\n";
+      return false;
+    }
+
+    // Map the summary's node IDs to ours.
+    std::vector<uint32_t> Local;
+    SmallVector<StringRef, 6> Fields;
+    for (++Line; !Line.is_at_eof(); ++Line) {
+      Fields.clear();
+      Line->split(Fields, "\t");
+
+      uint32_t ID, Dst;
+      if (Fields[0] == "n" && Fields.size() == 6 &&
+          !Fields[1].getAsInteger(10, ID)) {
+        if (Local.size() <= ID)
+          Local.resize(ID + 1, NoNode);
+        Local[ID] = addNode(Fields[2], Fields[3], Fields[4], Fields[5]);
+      } else if (Fields[0] == "f" && Fields.size() == 3 &&
+                 !Fields[1].getAsInteger(10, ID) &&
+                 !Fields[2].getAsInteger(10, Dst) &&
+                 ID < Local.size() && Dst < Local.size() &&
+                 Local[ID] != NoNode && Local[Dst] != NoNode) {
+        EdgeSrc.push_back(Local[ID]);
+        EdgeDst.push_back(Local[Dst]);
+      } else {
+        errs() << Path << ":" << Line.line_number()
+               << ": malformed summary record\n";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Propagate the annotation and print a suggestion for each unannotated
+  // node it reaches.
+  void solve(raw_ostream &OS) {
+    uint32_t N = State.size();
+
+    // Build a compressed adjacency list, then drop the edge list.
+    std::vector<uint32_t> Offsets(N + 1, 0);
+    for (uint32_t Src : EdgeSrc)
+      ++Offsets[Src + 1];
+    for (uint32_t i = 0; i < N; ++i)
+      Offsets[i + 1] += Offsets[i];
+    std::vector<uint32_t> Targets(EdgeSrc.size());
+    {
+      std::vector<uint32_t> Next(Offsets.begin(), Offsets.end() - 1);
+      for (size_t i = 0; i < EdgeSrc.size(); ++i)
+        Targets[Next[EdgeSrc[i]]++] = EdgeDst[i];
+    }
+    size_t NumFlows = EdgeSrc.size();
+    std::vector<uint32_t>().swap(EdgeSrc);
+    std::vector<uint32_t>().swap(EdgeDst);
+
+    // Search from every node declared with the annotation. Each node
+    // remembers where its annotation came from, for the suggestion.
+    std::vector<uint32_t> Parent(N, NoNode);
+    std::vector<uint32_t> Queue;
+    for (uint32_t i = 0; i < N; ++i) {
+      if (State[i] == Annotated) {
+        Parent[i] = i;
+        Queue.push_back(i);
+      }
+    }
+    for (size_t Head = 0; Head < Queue.size(); ++Head) {
+      uint32_t Src = Queue[Head];
+      for (uint32_t e = Offsets[Src]; e < Offsets[Src + 1]; ++e) {
+        uint32_t Dst = Targets[e];
+        if (Parent[Dst] == NoNode && State[Dst] == Unannotated) {
+          Parent[Dst] = Src;
+          Queue.push_back(Dst);
+        }
+      }
+    }
+
+    unsigned NumSuggested = 0;
+    for (uint32_t i = 0; i < N; ++i) {
+      if (State[i] != Unannotated || Parent[i] == NoNode || Locs[i].empty())
+        continue;
+      OS << Locs[i] << ": note: infer '" << Qual << "' for '" << Names[i]
+         << "' (from " << describe(Parent[i]) << ")\n";
+      ++NumSuggested;
+    }
+
+    errs() << "quala-infer: " << N << " nodes, " << NumFlows << " flows, "
+           << NumSuggested << " suggestions\n";
+  }
+
+private:
+  enum NodeState : uint8_t {
+    Unannotated,
+    Annotated,      // Has the annotation we are inferring.
+    OtherAnnotated  // Has a different annotation, which stops the flow.
+  };
+  enum : uint32_t { NoNode = ~0u };
+
+  StringMap<uint32_t> Keys;
+  std::vector<NodeState> State;
+  std::vector<std::string> Locs;
+  std::vector<std::string> Names;
+  std::vector<uint32_t> EdgeSrc;
+  std::vector<uint32_t> EdgeDst;
+
+  // Intern a node. The same declaration usually appears in many summaries
+  // (e.g., through a header); a declared annotation in any of them counts.
+  uint32_t addNode(StringRef Key, StringRef Ann, StringRef Loc,
+                   StringRef Name) {
+    auto Ins = Keys.insert(std::make_pair(Key, (uint32_t)State.size()));
+    uint32_t ID = Ins.first->getValue();
+    if (Ins.second) {
+      State.push_back(Unannotated);
+      Locs.push_back(std::string());
+      Names.push_back(Name.str());
+    }
+
+    if (Ann == Qual)
+      State[ID] = Annotated;
+    else if (Ann != "-" && State[ID] == Unannotated)
+      State[ID] = OtherAnnotated;
+
+    if (Locs[ID].empty() && Loc != "-")
+      Locs[ID] = Loc.str();
+    return ID;
+  }
+
+  std::string describe(uint32_t ID) const {
+    if (Locs[ID].empty())
+      return "a '" + Names[ID] + "' value";
+    return "'" + Names[ID] + "' at " + Locs[ID];
+  }
+};
+
+// Expand directories into the summaries they contain.
+void findSummaries(StringRef Path, std::vector<std::string> &Files) {
+  if (!sys::fs::is_directory(Path)) {
+    Files.push_back(Path.str());
+    return;
+  }
+  std::error_code EC;
+  std::vector<std::string> Found;
+  for (sys::fs::directory_iterator I(Path, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    if (sys::path::extension(I->path()) == ".qsum")
+      Found.push_back(I->path());
+  }
+  if (EC)
+    errs() << Path << ": " << EC.message() << "\n";
+  // Directory order is arbitrary; keep the output stable.
+  std::sort(Found.begin(), Found.end());
+  Files.insert(Files.end(), Found.begin(), Found.end());
+}
+
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "Quala qualifier inference\n");
+
+  std::vector<std::string> Files;
+  for (auto &Input : Inputs)
+    findSummaries(Input, Files);
+
+  Solver S;
+  for (auto &File : Files) {
+    if (!S.read(File))
+      return 1;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream OS(Output, EC, sys::fs::F_Text);
+  if (EC) {
+    errs() << Output << ": " << EC.message() << "\n";
+    return 1;
+  }
+  S.solve(OS);
+  return 0;
+}
@@ -0,0 +1,717 @@
+// quala-server: a long-lived compiler process for Quala builds.
+//
+// Every compile through the checker wrapper scripts normally starts a new
+// Clang, loads the checker plugins, and rebuilds its file caches from
+// scratch. This server keeps one process alive instead. Jobs arrive from
+// quala-client over a Unix socket along with the client's stdin, stdout, and
+// stderr, working directory, and environment. The server runs each job's
+// -cc1 steps in-process, so plugins are loaded once, and the file manager
+// (with its stat and directory caches) is reused across jobs.
+//
+// Loaded plugins cannot be unloaded, and the passes they register run in
+// every later compile in the same process. So jobs run in host processes,
+// one for each set of plugins that jobs load (with -Xclang -load). Each
+// worker process accepts jobs and hands them to its hosts, forking a new
+// host the first time it sees a set. Workers never load plugins
+// themselves, so every host starts clean.
+//
+// Each worker handles one job at a time. The server forks N workers (-j N,
+// default 1), and they all accept jobs from the same socket. The server
+// itself only restarts workers that die.
+//
+// Usage: quala-server [-j N] SOCKET
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/DiagnosticOptions.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/FileSystemStatCache.h"
+#include "clang/Driver/Compilation.h"
+#include "clang/Driver/Driver.h"
+#include "clang/Driver/Job.h"
+#include "clang/Driver/Options.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendDiagnostic.h"
+#include "clang/Frontend/TextDiagnosticBuffer.h"
+#include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/FrontendTool/Utils.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Option/ArgList.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "Protocol.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace clang;
+using namespace llvm;
+
+extern char **environ;
+
+namespace {
+
+// A job received from a client.
+struct Job {
+  int Fds[3];  // The client's stdin, stdout, and stderr.
+  std::string Cwd;
+  std::vector<std::string> Args;
+  std::vector<std::string> Env;
+};
+
+// Records every stat a FileManager makes, including the ones that found
+// nothing, so that its caches can be checked against the file system later.
+class RecordingStatCache : public FileSystemStatCache {
+public:
+  struct Seen {
+    bool Exists;
+    uint64_t Size;
+    time_t ModTime;
+  };
+  StringMap<Seen> Stats;
+
+  virtual LookupResult getStat(const char *Path, FileData &Data, bool isFile,
+                               std::unique_ptr<vfs::File> *F,
+                               vfs::FileSystem &FS) {
+    LookupResult Result = statChained(Path, Data, isFile, F, FS);
+    Seen S = { Result == CacheExists, 0, 0 };
+    if (S.Exists) {
+      S.Size = Data.Size;
+      S.ModTime = Data.ModTime;
+    }
+    Stats.insert(std::make_pair(Path, S));
+    return Result;
+  }
+
+  // Does the file system still look the way it did to the lookups made?
+  // Files must have kept their size and modification time, and paths that
+  // were missing must still be missing. Directories only have to still
+  // exist: their modification times change whenever a build writes an
+  // object file next to its sources, and a new file that matters (a
+  // generated header, say) shows up as a missing path that now exists.
+  // Paths under /usr/ are assumed not to change during a build.
+  bool isCurrent() const {
+    for (auto &Entry : Stats) {
+      StringRef Path = Entry.getKey();
+      if (Path.startswith("/usr/"))
+        continue;
+      const Seen &Old = Entry.getValue();
+      sys::fs::file_status Status;
+      bool Exists = !sys::fs::status(Path, Status) &&
+                    sys::fs::exists(Status);
+      if (Exists != Old.Exists)
+        return false;
+      if (Exists && !sys::fs::is_directory(Status) &&
+          (Status.getSize() != Old.Size ||
+           Status.getLastModificationTime().toEpochTime() !=
+             (uint64_t)Old.ModTime))
+        return false;
+    }
+    return true;
+  }
+};
+
+// File managers by working directory. A FileManager caches lookups by the
+// name it was asked for, so relative names are only meaningful in one
+// directory. Only the most recently used few are kept.
+struct CachedFiles {
+  IntrusiveRefCntPtr<FileManager> FM;
+  RecordingStatCache *Stats;  // Owned by FM.
+  unsigned LastUse;
+};
+StringMap<CachedFiles> FileManagers;
+unsigned FileManagerUses = 0;
+const unsigned MaxFileManagers = 16;
+
+// Get the cached file manager for the working directory, or a fresh one if
+// any file it looked up (found or not) has changed since.
+FileManager *getFileManager(const std::string &Cwd) {
+  if (!FileManagers.count(Cwd) && FileManagers.size() >= MaxFileManagers) {
+    auto Oldest = FileManagers.begin();
+    for (auto I = FileManagers.begin(); I != FileManagers.end(); ++I) {
+      if (I->second.LastUse < Oldest->second.LastUse)
+        Oldest = I;
+    }
+    FileManagers.erase(Oldest);
+  }
+
+  CachedFiles &Cached = FileManagers[Cwd];
+  Cached.LastUse = ++FileManagerUses;
+  if (Cached.FM && !Cached.Stats->isCurrent())
+    Cached.FM = nullptr;
+  if (!Cached.FM) {
+    FileSystemOptions FSOpts;
+    FSOpts.WorkingDir = Cwd;
+    Cached.FM = new FileManager(FSOpts);
+    Cached.Stats = new RecordingStatCache();
+    Cached.FM->addStatCache(std::unique_ptr<FileSystemStatCache>(Cached.Stats));
+  }
+  return Cached.FM.get();
+}
+
+// LLVM's fatal errors (e.g., "error in backend") leave the process in an
+// unknown state. Report one as cc1 does, then end the process: the worker
+// waiting on it passes the status on to the client and starts a new host
+// for the next job.
+void fatalError(void *UserData, const std::string &Message,
+                bool GenCrashDiag) {
+  DiagnosticsEngine &Diags = *static_cast<DiagnosticsEngine*>(UserData);
+  Diags.Report(diag::err_fe_error_backend) << Message;
+  errs().flush();
+  outs().flush();
+  _exit(1);
+}
+
+// Run one -cc1 invocation in this process, as cc1_main would.
+int runCC1(const opt::ArgStringList &Args, FileManager *Files) {
+  std::unique_ptr<CompilerInstance> Clang(new CompilerInstance());
+  IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
+
+  // Buffer diagnostics about the arguments until we have a real printer.
+  IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts = new DiagnosticOptions();
+  TextDiagnosticBuffer *DiagsBuffer = new TextDiagnosticBuffer;
+  DiagnosticsEngine Diags(DiagID, &*DiagOpts, DiagsBuffer);
+  bool Success = CompilerInvocation::CreateFromArgs(
+      Clang->getInvocation(), Args.data() + 1, Args.data() + Args.size(),
+      Diags);
+
+  Clang->createDiagnostics();
+  if (!Clang->hasDiagnostics())
+    return 1;
+  DiagsBuffer->FlushDiagnostics(Clang->getDiagnostics());
+  if (!Success)
+    return 1;
+
+  // The driver passes -disable-free because the process is about to exit.
+  // Ours is not.
+  Clang->getFrontendOpts().DisableFree = false;
+
+  Clang->setFileManager(Files);
+  install_fatal_error_handler(fatalError, &Clang->getDiagnostics());
+  Success = ExecuteCompilerInvocation(Clang.get());
+  remove_fatal_error_handler();
+  return Success ? 0 : 1;
+}
+
+// -mllvm and -backend-option options go into LLVM's global option registry,
+// which rejects most options given twice and never forgets them. Jobs that
+// use them run in a child process (which still shares the loaded plugins
+// and warm caches).
+bool needsFork(const opt::ArgStringList &Args) {
+  for (const char *Arg : Args) {
+    if (StringRef(Arg) == "-mllvm" || StringRef(Arg) == "-backend-option")
+      return true;
+  }
+  return false;
+}
+
+// Run a compilation the way the clang driver would, keeping -cc1 jobs
+// in-process.
+int compile(const std::vector<std::string> &Args, FileManager *Files) {
+  IntrusiveRefCntPtr<DiagnosticOptions> DiagOpts = new DiagnosticOptions();
+  TextDiagnosticPrinter *DiagClient =
+      new TextDiagnosticPrinter(errs(), &*DiagOpts);
+  IntrusiveRefCntPtr<DiagnosticIDs> DiagID(new DiagnosticIDs());
+  DiagnosticsEngine Diags(DiagID, &*DiagOpts, DiagClient);
+
+  // Clang's main() picks the driver mode from the program name.
+  std::vector<const char*> Argv;
+  for (auto &Arg : Args)
+    Argv.push_back(Arg.c_str());
+  if (StringRef(Args[0]).endswith("++"))
+    Argv.insert(Argv.begin() + 1, "--driver-mode=g++");
+
+  driver::Driver TheDriver(Args[0], sys::getDefaultTargetTriple(), Diags);
+  std::unique_ptr<driver::Compilation> C(TheDriver.BuildCompilation(Argv));
+  if (!C || C->containsError())
+    return 1;
+
+  // Let the driver handle anything that does not compile (-###, etc.).
+  if (C->getArgs().hasArg(driver::options::OPT__HASH_HASH_HASH)) {
+    SmallVector<std::pair<int, const driver::Command *>, 4> Failing;
+    return TheDriver.ExecuteCompilation(*C, Failing);
+  }
+
+  int Res = 0;
+  for (auto &Cmd : C->getJobs()) {
+    const opt::ArgStringList &CmdArgs = Cmd.getArguments();
+    if (!CmdArgs.empty() && StringRef(CmdArgs[0]) == "-cc1") {
+      if (needsFork(CmdArgs)) {
+        pid_t pid = fork();
+        if (pid == 0) {
+          int ChildRes = runCC1(CmdArgs, Files);
+          outs().flush();
+          _exit(ChildRes);
+        }
+        int Status = 1;
+        if (pid < 0 || waitpid(pid, &Status, 0) < 0)
+          Res = 1;
+        else
+          Res = WIFEXITED(Status) ? WEXITSTATUS(Status) : 1;
+      } else {
+        Res = runCC1(CmdArgs, Files);
+      }
+    } else {
+      // Linking, external assemblers, and such.
+      std::string ErrMsg;
+      bool Failed = false;
+      Res = Cmd.Execute(nullptr, &ErrMsg, &Failed);
+      if (Failed) {
+        errs() << "error: " << ErrMsg << "\n";
+        Res = 1;
+      }
+    }
+    if (Res)
+      break;
+  }
+
+  C->CleanupFileList(C->getTempFiles());
+  if (Res)
+    C->CleanupFileMap(C->getResultFiles(), nullptr, true);
+  return Res;
+}
+
+// Replace the whole environment with NAME=VALUE strings.
+void setEnvironment(const std::vector<std::string> &Env) {
+  std::vector<std::string> Names;
+  for (char **E = environ; *E; ++E)
+    Names.push_back(StringRef(*E).split('=').first);
+  for (auto &Name : Names)
+    unsetenv(Name.c_str());
+  for (auto &E : Env) {
+    auto NameValue = StringRef(E).split('=');
+    setenv(NameValue.first.str().c_str(), NameValue.second.str().c_str(), 1);
+  }
+}
+
+void closeFds(Job &J) {
+  for (int i = 0; i < 3; ++i) {
+    if (J.Fds[i] >= 0)
+      close(J.Fds[i]);
+    J.Fds[i] = -1;
+  }
+}
+
+// Run a job in the client's context: its stdio, directory, and environment.
+// A host handles one job at a time, so it can simply take these over.
+int runJob(Job &J) {
+  int Saved[3];
+  for (int i = 0; i < 3; ++i) {
+    Saved[i] = dup(i);
+    dup2(J.Fds[i], i);
+  }
+  std::vector<std::string> SavedEnv;
+  for (char **E = environ; *E; ++E)
+    SavedEnv.push_back(*E);
+
+  int Res = 1;
+  if (chdir(J.Cwd.c_str()) == 0) {
+    setEnvironment(J.Env);
+    Res = compile(J.Args, getFileManager(J.Cwd));
+  } else {
+    errs() << "quala-server: cannot enter " << J.Cwd << "\n";
+  }
+
+  outs().flush();
+  errs().flush();
+  fflush(stdout);
+  fflush(stderr);
+
+  setEnvironment(SavedEnv);
+  for (int i = 0; i < 3; ++i) {
+    dup2(Saved[i], i);
+    close(Saved[i]);
+  }
+  closeFds(J);
+  return Res;
+}
+
+bool writeFully(int Fd, const char *Buf, size_t Size) {
+  while (Size) {
+    ssize_t n = write(Fd, Buf, Size);
+    if (n <= 0)
+      return false;
+    Buf += n;
+    Size -= n;
+  }
+  return true;
+}
+
+bool readFully(int Fd, char *Buf, size_t Size) {
+  while (Size) {
+    ssize_t n = read(Fd, Buf, Size);
+    if (n <= 0)
+      return false;
+    Buf += n;
+    Size -= n;
+  }
+  return true;
+}
+
+// Receive a job: the header (with the client's descriptors attached) and
+// then the strings.
+bool receiveJob(int Conn, Job &J) {
+  struct QualaJobHeader Header;
+  char Control[CMSG_SPACE(sizeof(int) * 3)];
+  struct iovec IOV = { &Header, sizeof(Header) };
+  struct msghdr Msg;
+  memset(&Msg, 0, sizeof(Msg));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  if (recvmsg(Conn, &Msg, MSG_WAITALL) != sizeof(Header))
+    return false;
+
+  struct cmsghdr *CMsg = CMSG_FIRSTHDR(&Msg);
+  if (!CMsg || CMsg->cmsg_type != SCM_RIGHTS ||
+      CMsg->cmsg_len != CMSG_LEN(sizeof(int) * 3))
+    return false;
+  memcpy(J.Fds, CMSG_DATA(CMsg), sizeof(int) * 3);
+
+  if (Header.Magic != QUALA_PROTOCOL_MAGIC || Header.Argc == 0 ||
+      Header.Size > QUALA_MAX_JOB_SIZE)
+    return false;
+  std::vector<char> Buf(Header.Size);
+  if (!readFully(Conn, Buf.data(), Buf.size()) || Buf.back() != '\0')
+    return false;
+
+  // The strings are the working directory, the arguments, and then the
+  // environment, each NUL-terminated.
+  std::vector<std::string> Strings;
+  for (const char *P = Buf.data(); P < Buf.data() + Buf.size();
+       P += strlen(P) + 1)
+    Strings.push_back(P);
+  if (Strings.size() != 1 + Header.Argc + Header.Envc)
+    return false;
+  J.Cwd = Strings[0];
+  J.Args.assign(Strings.begin() + 1, Strings.begin() + 1 + Header.Argc);
+  J.Env.assign(Strings.begin() + 1 + Header.Argc, Strings.end());
+  return true;
+}
+
+// Send a job on to a host, the same way the client sent it.
+bool sendJob(int Fd, const Job &J) {
+  std::string Buf;
+  Buf.append(J.Cwd.c_str(), J.Cwd.size() + 1);
+  for (auto &Arg : J.Args)
+    Buf.append(Arg.c_str(), Arg.size() + 1);
+  for (auto &E : J.Env)
+    Buf.append(E.c_str(), E.size() + 1);
+
+  struct QualaJobHeader Header = {
+    QUALA_PROTOCOL_MAGIC, (uint32_t)J.Args.size(), (uint32_t)J.Env.size(),
+    (uint32_t)Buf.size()
+  };
+  char Control[CMSG_SPACE(sizeof(int) * 3)];
+  memset(Control, 0, sizeof(Control));
+  struct iovec IOV = { &Header, sizeof(Header) };
+  struct msghdr Msg;
+  memset(&Msg, 0, sizeof(Msg));
+  Msg.msg_iov = &IOV;
+  Msg.msg_iovlen = 1;
+  Msg.msg_control = Control;
+  Msg.msg_controllen = sizeof(Control);
+  struct cmsghdr *CMsg = CMSG_FIRSTHDR(&Msg);
+  CMsg->cmsg_level = SOL_SOCKET;
+  CMsg->cmsg_type = SCM_RIGHTS;
+  CMsg->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+  memcpy(CMSG_DATA(CMsg), J.Fds, sizeof(int) * 3);
+
+  return sendmsg(Fd, &Msg, 0) == sizeof(Header) &&
+         writeFully(Fd, Buf.data(), Buf.size());
+}
+
+// The plugins a job loads, in order, by real path and modification time
+// (so that a rebuilt plugin gets a new host).
+std::string pluginsOf(const Job &J) {
+  std::string Key;
+  raw_string_ostream KOS(Key);
+  const std::vector<std::string> &A = J.Args;
+  for (size_t i = 0; i + 3 < A.size(); ++i) {
+    if (A[i] != "-Xclang" || A[i + 1] != "-load" || A[i + 2] != "-Xclang")
+      continue;
+    i += 3;
+    SmallString<128> Path(A[i]);
+    if (sys::path::is_relative(Path)) {
+      Path = J.Cwd;
+      sys::path::append(Path, A[i]);
+    }
+    if (char *Real = realpath(Path.c_str(), nullptr)) {
+      Path = Real;
+      free(Real);
+    }
+    sys::fs::file_status Status;
+    KOS << Path;
+    if (!sys::fs::status(Path, Status))
+      KOS << "@" << Status.getLastModificationTime().toEpochTime();
+    KOS << "\n";
+  }
+  return KOS.str();
+}
+
+// A host process runs the jobs for one set of plugins.
+struct Host {
+  pid_t Pid;
+  int Fd;  // Our end of a socket pair: jobs go out, statuses come back.
+  unsigned LastUse;
+};
+StringMap<Host> Hosts;
+unsigned HostUses = 0;
+const unsigned MaxHosts = 8;
+
+// Run jobs from the worker until it goes away.
+void host(int Fd) {
+  for (;;) {
+    Job J;
+    J.Fds[0] = J.Fds[1] = J.Fds[2] = -1;
+    if (!receiveJob(Fd, J)) {
+      closeFds(J);
+      return;
+    }
+    int32_t Status = runJob(J);
+    if (write(Fd, &Status, sizeof(Status)) != sizeof(Status))
+      return;
+  }
+}
+
+// Stop an idle host. It exits when it sees the socket close.
+void stopHost(StringMap<Host>::iterator It) {
+  close(It->second.Fd);
+  waitpid(It->second.Pid, nullptr, 0);
+  Hosts.erase(It);
+}
+
+// Get the host for a set of plugins, starting it if needed. Only a few
+// stay around: the least recently used one makes way for a new set. The
+// new host must not keep the worker's descriptors open: not the socket,
+// not the client's connection or streams (a client reading our output to
+// the end would wait forever), and not the other hosts.
+Host *hostFor(StringRef Key, int Sock, int Conn, Job &J) {
+  auto It = Hosts.find(Key);
+  if (It == Hosts.end()) {
+    if (Hosts.size() >= MaxHosts) {
+      auto Oldest = Hosts.begin();
+      for (auto I = Hosts.begin(); I != Hosts.end(); ++I) {
+        if (I->second.LastUse < Oldest->second.LastUse)
+          Oldest = I;
+      }
+      stopHost(Oldest);
+    }
+
+    int Fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, Fds) < 0) {
+      perror("quala-server");
+      return nullptr;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(Sock);
+      close(Conn);
+      closeFds(J);
+      close(Fds[0]);
+      for (auto &Other : Hosts)
+        close(Other.second.Fd);
+      host(Fds[1]);
+      _exit(1);
+    }
+    close(Fds[1]);
+    if (pid < 0) {
+      perror("quala-server");
+      close(Fds[0]);
+      return nullptr;
+    }
+    Host H = { pid, Fds[0], 0 };
+    It = Hosts.insert(std::make_pair(Key, H)).first;
+  }
+  It->second.LastUse = ++HostUses;
+  return &It->second;
+}
+
+// Run a job in the host for its plugins.
+int32_t runInHost(Job &J, int Sock, int Conn) {
+  std::string Key = pluginsOf(J);
+  Host *H = hostFor(Key, Sock, Conn, J);
+  if (!H)
+    return 1;
+  int32_t Status;
+  if (sendJob(H->Fd, J) &&
+      readFully(H->Fd, (char *)&Status, sizeof(Status)))
+    return Status;
+
+  // The host died during the job: it hit a fatal error (and reported it),
+  // or it crashed, in a plugin say. Start a new one next time.
+  int WStatus = 0;
+  pid_t pid = H->Pid;
+  close(H->Fd);
+  Hosts.erase(Key);
+  if (waitpid(pid, &WStatus, 0) < 0)
+    return 1;
+  if (WIFSIGNALED(WStatus)) {
+    dprintf(J.Fds[2], "quala-server: compiler died from signal %d\n",
+            WTERMSIG(WStatus));
+    return 1;
+  }
+  return WIFEXITED(WStatus) && WEXITSTATUS(WStatus) ?
+      WEXITSTATUS(WStatus) : 1;
+}
+
+int listenOn(const char *Path) {
+  struct sockaddr_un Addr;
+  if (strlen(Path) >= sizeof(Addr.sun_path)) {
+    errs() << "quala-server: socket path too long: " << Path << "\n";
+    return -1;
+  }
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sun_family = AF_UNIX;
+  strcpy(Addr.sun_path, Path);
+
+  int Sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(Path);
+  if (Sock < 0 || bind(Sock, (struct sockaddr *)&Addr, sizeof(Addr)) < 0 ||
+      listen(Sock, 64) < 0) {
+    perror("quala-server");
+    return -1;
+  }
+  return Sock;
+}
+
+// Accept jobs forever and run each in its host.
+void serve(int Sock) {
+  for (;;) {
+    int Conn = accept(Sock, nullptr, nullptr);
+    if (Conn < 0)
+      continue;
+    Job J;
+    J.Fds[0] = J.Fds[1] = J.Fds[2] = -1;
+    int32_t Status = 1;
+    if (receiveJob(Conn, J))
+      Status = runInHost(J, Sock, Conn);
+    closeFds(J);
+    // The client falls back to compiling locally if this does not arrive,
+    // so just note it.
+    if (write(Conn, &Status, sizeof(Status)) != sizeof(Status))
+      errs() << "quala-server: cannot send job status: " << strerror(errno)
+             << "\n";
+    close(Conn);
+  }
+}
+
+volatile sig_atomic_t Stopping = 0;
+
+void stop(int) {
+  Stopping = 1;
+}
+
+pid_t startWorker(int Sock) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    signal(SIGTERM, SIG_DFL);
+    serve(Sock);
+    _exit(0);
+  }
+  if (pid < 0)
+    perror("quala-server");
+  return pid;
+}
+
+}
+
+int main(int argc, const char **argv) {
+  sys::PrintStackTraceOnErrorSignal();
+  signal(SIGPIPE, SIG_IGN);
+
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  InitializeAllAsmParsers();
+
+  // Arguments are parsed by hand: LLVM's option registry also receives the
+  // jobs' -mllvm options, which must not collide with ours.
+  const char *SocketPath = nullptr;
+  unsigned Workers = 1;
+  for (int i = 1; i < argc; ++i) {
+    if (StringRef(argv[i]) == "-j" && i + 1 < argc) {
+      if (StringRef(argv[++i]).getAsInteger(10, Workers) || !Workers) {
+        SocketPath = nullptr;
+        break;
+      }
+    } else if (!SocketPath) {
+      SocketPath = argv[i];
+    } else {
+      SocketPath = nullptr;
+      break;
+    }
+  }
+  if (!SocketPath) {
+    errs() << "usage: " << argv[0]
+           << " [-j workers] socket\n";
+    return 1;
+  }
+
+  int Sock = listenOn(SocketPath);
+  if (Sock < 0)
+    return 1;
+
+  // SIGTERM stops the workers too. (Their hosts exit when the workers
+  // go away.) No SA_RESTART, so that it interrupts the wait below.
+  struct sigaction Action;
+  memset(&Action, 0, sizeof(Action));
+  Action.sa_handler = stop;
+  sigaction(SIGTERM, &Action, nullptr);
+
+  // Keep the workers running. A worker that crashes is replaced, though
+  // not more than once a second, in case it crashes on startup.
+  std::vector<pid_t> Running;
+  for (unsigned i = 0; i < Workers; ++i) {
+    pid_t pid = startWorker(Sock);
+    if (pid > 0)
+      Running.push_back(pid);
+  }
+  time_t LastStart = 0;
+  while (!Running.empty() && !Stopping) {
+    int Status;
+    pid_t pid = wait(&Status);
+    if (pid < 0) {
+      if (errno == EINTR)
+        continue;
+      perror("quala-server");
+      break;
+    }
+    Running.erase(std::remove(Running.begin(), Running.end(), pid),
+                  Running.end());
+    if (Stopping)
+      break;
+    if (WIFSIGNALED(Status)) {
+      errs() << "quala-server: worker " << pid << " died from signal "
+             << WTERMSIG(Status) << "; restarting it\n";
+    }
+    if (time(nullptr) == LastStart)
+      sleep(1);
+    LastStart = time(nullptr);
+    pid = startWorker(Sock);
+    if (pid > 0)
+      Running.push_back(pid);
+  }
+
+  for (pid_t pid : Running)
+    kill(pid, SIGTERM);
+  unlink(SocketPath);
+  return Stopping ? 0 : 1;
+}
@@ -0,0 +1,30 @@
+#!/bin/sh
+# The compiles for server.c. Each one's output and exit status go to
+# OUT.1, OUT.2, and so on. They go through quala-server when QUALA_SERVER
+# is set.
+out=$1
+inputs=`dirname $0`
+examples=$inputs/../../../examples
+
+# The nullness checker and its passes.
+$examples/nullness/nullness-cc -S -emit-llvm -o - $inputs/nullable.c \
+    > $out.1 2>&1
+echo "exit $?" >> $out.1
+
+# Another plugin on the same code. No null checks may show up.
+$examples/tainting/ttclang -S -emit-llvm -o - $inputs/nullable.c \
+    > $out.2 2>&1
+echo "exit $?" >> $out.2
+
+# Checker errors.
+$examples/tainting/ttclang -fsyntax-only $inputs/tainted.c > $out.3 2>&1
+echo "exit $?" >> $out.3
+
+# A fatal error in the backend.
+$inputs/../../../bin/cc -c -o /dev/null $inputs/fatal.c > $out.4 2>&1
+echo "exit $?" >> $out.4
+
+# The first compile again, after the fatal error.
+$examples/nullness/nullness-cc -S -emit-llvm -o - $inputs/nullable.c \
+    > $out.5 2>&1
+echo "exit $?" >> $out.5
@@ -0,0 +1,8 @@
+// Clang accepts any register name here, but the x86 backend can only read
+// the stack pointer as a global register variable. Anything else is a
+// fatal "error in backend".
+register unsigned long reg asm("eax");
+
+unsigned long get(void) {
+  return reg;
+}
@@ -0,0 +1,6 @@
+#define NULLABLE __attribute__((type_annotate("nullable")))
+
+int get(int * NULLABLE p) {
+  int *q = p;
+  return *p + *q;
+}
@@ -0,0 +1,6 @@
+#define TAINTED __attribute__((type_annotate("tainted")))
+
+int leak(TAINTED int secret) {
+  int out = secret;
+  return out;
+}
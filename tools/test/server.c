@@ -0,0 +1,24 @@
+// Compiles through quala-server must behave exactly like direct ones: the
+// same output, diagnostics, and exit status, no passes from the plugins of
+// other jobs, and a fatal error in one job must not break the next.
+// RUN: rm -rf %t && mkdir -p %t
+// RUN: env -u QUALA_SERVER sh Inputs/compile.sh %t/direct
+// RUN: ./with-server sh -c "sh Inputs/compile.sh %t/served && sh Inputs/compile.sh %t/again"
+// RUN: for i in 1 2 3 4 5; do diff %t/direct.$i %t/served.$i && diff %t/direct.$i %t/again.$i || exit 1; done
+// RUN: FileCheck --check-prefix=NULLNESS %s < %t/direct.1
+// RUN: FileCheck --check-prefix=TAINTING %s < %t/direct.2
+// RUN: FileCheck --check-prefix=ERRORS %s < %t/direct.3
+// RUN: FileCheck --check-prefix=FATAL %s < %t/direct.4
+
+// NULLNESS: warning: {{.*}}may become null
+// NULLNESS: call void @qualaNullCheck
+// NULLNESS: exit 0
+
+// TAINTING-NOT: qualaNullCheck
+// TAINTING: exit 0
+
+// ERRORS: error: {{.*}}incompatible
+// ERRORS: exit 1
+
+// FATAL: fatal error: error in backend: Invalid register name global variable
+// FATAL: exit 1